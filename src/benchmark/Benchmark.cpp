@@ -0,0 +1,292 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+/*
+ * Benchmark.cpp
+ *
+ * Compares optional code paths of OpenTLD on sequences with known motion.
+ * The sequences move a texture, either the given grayscale image or smoothed
+ * noise, by a known subpixel translation per frame.
+ *
+ *   tldbenchmark lk [image]   fixed-point LK kernel against cv::calcOpticalFlowPyrLK
+ *   tldbenchmark nn [image]   float NN samples against int8/int16 samples
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include "lk.h"
+#include "DetectorCascade.h"
+#include "NNClassifier.h"
+#include "TLDUtil.h"
+
+using namespace cv;
+using namespace std;
+using namespace tld;
+
+static const int FRAME_WIDTH = 320;
+static const int FRAME_HEIGHT = 240;
+static const int NUM_FRAMES = 60;
+static const float NOISE_SIGMA = 4;
+static const int NN_TRAIN_FRAMES = 10;
+
+//Texture the frames are cut from, large enough for the motion of all frames
+static Mat loadTexture(const char * path) {
+	if(path != NULL) {
+		IplImage * img = cvLoadImage(path, CV_LOAD_IMAGE_GRAYSCALE);
+
+		if(img == NULL) {
+			printf("Error: Unable to load %s\n", path);
+			exit(1);
+		}
+
+		Mat texture(img, true);
+		cvReleaseImage(&img);
+		resize(texture, texture, Size(2 * FRAME_WIDTH, 2 * FRAME_HEIGHT), 0, 0, INTER_AREA);
+		return texture;
+	}
+
+	Mat texture(2 * FRAME_HEIGHT, 2 * FRAME_WIDTH, CV_8UC1);
+	RNG rng(0);
+	rng.fill(texture, RNG::UNIFORM, 0, 256);
+	GaussianBlur(texture, texture, Size(0, 0), 2);
+	return texture;
+}
+
+//Offset of frame f in the texture
+static Point2f frameOffset(int f) {
+	return Point2f(2.3f * f, 1.1f * f + 3 * sin(f * 0.3f));
+}
+
+//Frames of the moving texture with sensor noise
+static void makeSequence(Mat const & texture, vector<Mat> & frames) {
+	RNG rng(1);
+	frames.resize(NUM_FRAMES);
+
+	for(int f = 0; f < NUM_FRAMES; f++) {
+		Point2f offset = frameOffset(f);
+		Mat shift = (Mat_<double>(2, 3) << 1, 0, -offset.x, 0, 1, -offset.y);
+		warpAffine(texture, frames[f], shift, Size(FRAME_WIDTH, FRAME_HEIGHT), INTER_LINEAR, BORDER_REPLICATE);
+
+		for(int y = 0; y < FRAME_HEIGHT; y++) {
+			uchar * row = frames[f].ptr<uchar>(y);
+
+			for(int x = 0; x < FRAME_WIDTH; x++) {
+				row[x] = saturate_cast<uchar>(row[x] + rng.gaussian(NOISE_SIGMA));
+			}
+		}
+	}
+}
+
+//Object of the nn benchmark, a part of the texture that moves with it
+static Rect objectBox(int f) {
+	Point2f offset = frameOffset(0) - frameOffset(f);
+	return Rect(cvRound(200 + offset.x), cvRound(80 + offset.y), 60, 60);
+}
+
+//Tracks a 10x10 grid spanning each frame, including points at the border, into the next frame
+static void benchmarkLK(vector<Mat> & frames, bool native) {
+	const int n = 100;
+	float pts[2 * n];
+	float tracked[2 * n];
+	float fb[n];
+	float ncc[n];
+	char status[n];
+	vector<float> fbErrors;
+	double error = 0;
+	int numTracked = 0;
+	int64 ticks = 0;
+
+	LKCache cache;
+	initLKCache(&cache);
+	cache.useNative = native;
+	ScratchArena scratch;
+	initScratchArena(&scratch);
+
+	for(int f = 0; f + 1 < NUM_FRAMES; f++) {
+		IplImage prevImg = frames[f];
+		IplImage currImg = frames[f + 1];
+		Point2f motion = frameOffset(f) - frameOffset(f + 1);
+
+		for(int i = 0; i < n; i++) {
+			pts[2 * i] = (i % 10) * (FRAME_WIDTH - 1) / 9.f;
+			pts[2 * i + 1] = (i / 10) * (FRAME_HEIGHT - 1) / 9.f;
+			tracked[2 * i] = pts[2 * i];
+			tracked[2 * i + 1] = pts[2 * i + 1];
+		}
+
+		int64 start = getTickCount();
+		trackLK(&cache, &prevImg, &currImg, pts, n, tracked, n, 5, fb, ncc, status, &scratch);
+		ticks += getTickCount() - start;
+		resetScratchArena(&scratch);
+
+		for(int i = 0; i < n; i++) {
+			if(status[i] == 1) {
+				float dx = tracked[2 * i] - pts[2 * i] - motion.x;
+				float dy = tracked[2 * i + 1] - pts[2 * i + 1] - motion.y;
+				error += sqrt(dx * dx + dy * dy);
+				fbErrors.push_back(fb[i]);
+				numTracked++;
+			}
+		}
+	}
+
+	releaseLKCache(&cache);
+	releaseScratchArena(&scratch);
+
+	float medianFb = 0;
+
+	if(!fbErrors.empty()) {
+		nth_element(fbErrors.begin(), fbErrors.begin() + fbErrors.size() / 2, fbErrors.end());
+		medianFb = fbErrors[fbErrors.size() / 2];
+	}
+
+	int numPairs = NUM_FRAMES - 1;
+	printf("%-8s %10.3f %9.1f%% %12.4f %12.4f\n", native ? "native" : "opencv",
+	       ticks / getTickFrequency() * 1000 / numPairs, 100.f * numTracked / (numPairs * n),
+	       medianFb, numTracked > 0 ? error / numTracked : 0);
+}
+
+//Learns the object in the first frames like TLD does, with the background windows as negatives.
+//In the remaining frames, the object shifted by up to a pixel and the background windows are classified.
+//Windows that overlap the object by 0.2 or more are ambiguous and not counted.
+static void benchmarkNN(vector<Mat> & frames, int quantization) {
+	Rect box = objectBox(0);
+	vector<int> windows;
+
+	for(int y = 0; y + box.height <= FRAME_HEIGHT; y += box.height / 6) {
+		for(int x = 0; x + box.width <= FRAME_WIDTH; x += box.width / 6) {
+			int window[TLD_WINDOW_SIZE] = {x, y, box.width, box.height, 0};
+			windows.insert(windows.end(), window, window + TLD_WINDOW_SIZE);
+		}
+	}
+
+	int numBackground = windows.size() / TLD_WINDOW_SIZE;
+	int numWindows = numBackground + 9;
+	windows.resize(numWindows * TLD_WINDOW_SIZE);
+	vector<float> overlap(numBackground);
+
+	NNClassifier * nn = NNClassifier::create(TLD_PATCH_SIZE);
+	nn->setQuantization(quantization);
+	nn->windows = &windows[0];
+
+	int truePositives = 0, falseNegatives = 0, falsePositives = 0;
+	int numClassified = 0;
+	float minObjectConf = 1, maxBackgroundConf = 0;
+	int64 ticks = 0;
+
+	for(int f = 0; f < NUM_FRAMES; f++) {
+		Rect object = objectBox(f);
+
+		for(int i = 0; i < 9; i++) {
+			int * window = &windows[TLD_WINDOW_SIZE * (numBackground + i)];
+			window[0] = object.x + i % 3 - 1;
+			window[1] = object.y + i / 3 - 1;
+			window[2] = object.width;
+			window[3] = object.height;
+		}
+
+		nn->beginFrame(frames[f], numWindows);
+		tldOverlapRect(&windows[0], numBackground, object, &overlap[0]);
+
+		if(f < NN_TRAIN_FRAMES) {
+			vector<int> negatives;
+
+			for(int i = 0; i < numBackground; i++) {
+				if(overlap[i] < 0.2) {
+					negatives.push_back(i);
+				}
+			}
+
+			nn->learn(frames[f], object, negatives);
+			continue;
+		}
+
+		int64 start = getTickCount();
+
+		for(int i = 0; i < numWindows; i++) {
+			bool isObject = i >= numBackground;
+
+			if(!isObject && overlap[i] >= 0.2) {
+				continue;
+			}
+
+			float conf = nn->classifyWindow(frames[f], i);
+			bool detected = conf >= nn->thetaTP;
+			minObjectConf = isObject ? min(minObjectConf, conf) : minObjectConf;
+			maxBackgroundConf = isObject ? maxBackgroundConf : max(maxBackgroundConf, conf);
+			truePositives += isObject && detected;
+			falseNegatives += isObject && !detected;
+			falsePositives += !isObject && detected;
+			numClassified++;
+		}
+
+		ticks += getTickCount() - start;
+	}
+
+	printf("%-8s %5zu/%-5zu %9.1f%% %9.1f%% %12.4f %12.4f %10.2f\n", quantization == 0 ? "float" : quantization == 8 ? "int8" : "int16",
+	       nn->numPositives(), nn->numNegatives(),
+	       100.f * truePositives / max(truePositives + falseNegatives, 1),
+	       100.f * truePositives / max(truePositives + falsePositives, 1),
+	       minObjectConf, maxBackgroundConf,
+	       ticks / getTickFrequency() * 1e6 / max(numClassified, 1));
+
+	delete nn;
+}
+
+static int usage() {
+	printf("Usage: tldbenchmark lk|nn [image]\n");
+	printf("  lk  Speed and accuracy of the fixed-point LK kernel against cv::calcOpticalFlowPyrLK\n");
+	printf("  nn  Recall and precision of the NN classifier with float, int8 and int16 samples\n");
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char ** argv) {
+	if(argc < 2) {
+		return usage();
+	}
+
+	vector<Mat> frames;
+	makeSequence(loadTexture(argc > 2 ? argv[2] : NULL), frames);
+
+	if(strcmp(argv[1], "lk") == 0) {
+		printf("%d frame pairs of %dx%d, 100 points per pair\n", NUM_FRAMES - 1, FRAME_WIDTH, FRAME_HEIGHT);
+		printf("%-8s %10s %10s %12s %12s\n", "kernel", "ms/pair", "tracked", "median FB", "mean error");
+		benchmarkLK(frames, false);
+		benchmarkLK(frames, true);
+		return EXIT_SUCCESS;
+	}
+
+	if(strcmp(argv[1], "nn") == 0) {
+		printf("Trained on %d frames, tested on %d frames\n", NN_TRAIN_FRAMES, NUM_FRAMES - NN_TRAIN_FRAMES);
+		printf("%-8s %11s %10s %10s %12s %12s %10s\n", "samples", "pos/neg", "recall", "precision", "min object", "max backgr.", "us/window");
+		benchmarkNN(frames, 0);
+		benchmarkNN(frames, 8);
+		benchmarkNN(frames, 16);
+		return EXIT_SUCCESS;
+	}
+
+	return usage();
+}
@@ -28,6 +28,7 @@
 #include "imAcq.h"
 #include "gui.h"
 #include "TLDUtil.h"
+#include "heapcounter.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
@@ -82,6 +83,28 @@
         resultsFile = fopen(printResults, "w");
     }
 
+    //Latencies of the tracker estimate and of the final result in ms, measured from the call of processImage()
+    FILE * timingFile = NULL;
+    double trackerLatency = -1;
+
+    if(printTiming != NULL) {
+        timingFile = fopen(printTiming, "w");
+
+        tld->setResultCallbacks(
+            [&trackerLatency](TLDResult const & result) {
+                trackerLatency = result.timestamp - result.frameStart;
+            },
+            [&trackerLatency, timingFile](TLDResult const & result) {
+                if(trackerLatency >= 0) {
+                    fprintf(timingFile, "%d %.2f %.2f\n", result.frame, trackerLatency, result.timestamp - result.frameStart);
+                } else {
+                    fprintf(timingFile, "%d NaN %.2f\n", result.frame, result.timestamp - result.frameStart);
+                }
+
+                trackerLatency = -1;
+            });
+    }
+
     bool reuseFrameOnce = false;
     bool skipProcessingOnce = false;
     if(loadModel && modelPath != NULL) {
@@ -99,6 +122,8 @@
 
     cvReleaseImage(&grey);
 
+    long frameAllocations = 0; //Heap allocations of the last call of processImage(), on all threads
+
     while(imAcqHasMoreFrames(imAcq)) {
         double tic = cvGetTickCount();
 
@@ -115,7 +140,13 @@
 
         if(!skipProcessingOnce) {
             cv::blur(Mat(img),Mat(img),cv::Size(3,3));
+            long const allocationsBefore = heapAllocations();
             tld->processImage(img);
+            frameAllocations = heapAllocations() - allocationsBefore;
+
+            if(tld->framesSinceSelection() == 1 && tld->selectionLatency() >= 0) {
+                printf("Selection to first tracked frame: %.1f ms\n", tld->selectionLatency());
+            }
 
         } else {
             skipProcessingOnce = false;
@@ -144,17 +175,20 @@
 
         if(showOutput || saveDir != NULL)
         {
-            char string[128];
+            char string[160];
 
-            char learningString[10] = "";
+            char learningString[32] = "";
 
             if(tld->isLearning())
             {
-                strcpy(learningString, "Learning");
+                sprintf(learningString, "Learning %d samples", tld->learnedSamples());
             }
 
-            sprintf(string, "#%d,Posterior %.2f; fps: %.2f, #numwindows:%d, %s", imAcq->currentFrame-1,
-                    tldConfidence, fps, tld->detector()->numWindows, learningString);
+            char const detectionModes[] = {'-', 'L', 'F'}; //Indexed by TLD::DetectionMode
+
+            sprintf(string, "#%d,Posterior %.2f; fps: %.2f, #numwindows:%d, #mallocs:%ld, detection:%c/%d, %s", imAcq->currentFrame-1,
+                    tldConfidence, fps, tld->detector()->numWindows, frameAllocations,
+                    detectionModes[tld->lastDetectionMode()], tld->currentDetectionInterval(), learningString);
 
             CvScalar yellow = CV_RGB(255,255,0);
             CvScalar blue = CV_RGB(0,0,255);
@@ -267,6 +301,11 @@
         }
     }
 
+    if(timingFile != NULL) {
+        tld->setResultCallbacks(nullptr, nullptr);
+        fclose(timingFile);
+    }
+
     if(exportModelAfterRun) {
         tld->writeToFile(modelExportFile);
     }
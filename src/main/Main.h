@@ -44,6 +44,7 @@ public:
 	Gui * gui;
 	bool showOutput;
 	const char * printResults;
+	const char * printTiming;
 	const char * saveDir;
 	double threshold;
 	bool showForeground;
@@ -61,6 +62,7 @@ public:
 		tld = new TLD();
 		showOutput = 1;
 		printResults = NULL;
+		printTiming = NULL;
 		saveDir = ".";
 		threshold = 0.5;
 		showForeground = 0;
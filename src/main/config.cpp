@@ -285,6 +285,12 @@ int Config::init(int argc, char ** argv) {
 		m_cfg.lookupValue("detector.thetaP", m_settings.m_thetaP);
 		m_cfg.lookupValue("detector.thetaN", m_settings.m_thetaN);
 
+		// nnQuantization
+		m_cfg.lookupValue("detector.nnQuantization", m_settings.m_nnQuantization);
+
+		// patchSize
+		m_cfg.lookupValue("detector.patchSize", m_settings.m_patchSize);
+
 		// backgroundFrame
 		// TODO
 		//const char * backgroundFrame = NULL;
@@ -311,9 +317,42 @@ int Config::init(int argc, char ** argv) {
 		// learningEnabled
 		m_cfg.lookupValue("learningEnabled", m_settings.m_learningEnabled);
 
+		// asyncLearning
+		m_cfg.lookupValue("asyncLearning", m_settings.m_asyncLearning);
+
+		// numWarps
+		m_cfg.lookupValue("numWarps", m_settings.m_numWarps);
+
+		// learning budget
+		m_cfg.lookupValue("learningConfidence", m_settings.m_learningConfidence);
+		m_cfg.lookupValue("maxLearningPositives", m_settings.m_maxLearningPositives);
+		m_cfg.lookupValue("maxLearningNegatives", m_settings.m_maxLearningNegatives);
+		m_cfg.lookupValue("maxLearningNegativesNN", m_settings.m_maxLearningNegativesNN);
+
 		// trackerEnabled
 		m_cfg.lookupValue("trackerEnabled", m_settings.m_trackerEnabled);
 
+		// trackerPoints
+		m_cfg.lookupValue("trackerPoints", m_settings.m_trackerPoints);
+
+		// trackerObjectSize
+		m_cfg.lookupValue("trackerObjectSize", m_settings.m_trackerObjectSize);
+
+		// motionModel
+		m_cfg.lookupValue("motionModel", m_settings.m_motionModel);
+
+		// detection schedule
+		m_cfg.lookupValue("maxDetectionInterval", m_settings.m_maxDetectionInterval);
+		m_cfg.lookupValue("detectionConfidence", m_settings.m_detectionConfidence);
+		m_cfg.lookupValue("detectionMaxFbError", m_settings.m_detectionMaxFbError);
+		m_cfg.lookupValue("detectionMaxMotion", m_settings.m_detectionMaxMotion);
+
+		// concurrentTracking
+		m_cfg.lookupValue("concurrentTracking", m_settings.m_concurrentTracking);
+
+		// nativeLK
+		m_cfg.lookupValue("nativeLK", m_settings.m_nativeLK);
+
 		// varianceFilterEnabled
 		m_cfg.lookupValue("detector.varianceFilterEnabled", m_settings.m_varianceFilterEnabled);
 
@@ -385,11 +424,23 @@ int Config::configure(Main* main) {
 
 	// main
     main->tld->setTracker(m_settings.m_trackerEnabled);
+    main->tld->setTrackerPoints( m_settings.m_trackerPoints );
+    main->tld->setTrackerObjectSize( m_settings.m_trackerObjectSize );
+    main->tld->setNativeLK( m_settings.m_nativeLK );
+    main->tld->setMotionModel( m_settings.m_motionModel );
     main->tld->setAlternating( m_settings.m_alternating );
+    main->tld->setConcurrentTracking( m_settings.m_concurrentTracking );
+    main->tld->setDetectionSchedule( m_settings.m_maxDetectionInterval, m_settings.m_detectionConfidence,
+                                     m_settings.m_detectionMaxFbError, m_settings.m_detectionMaxMotion );
     main->tld->setLearning( m_settings.m_learningEnabled );
+    main->tld->setAsyncLearning( m_settings.m_asyncLearning );
+    main->tld->setNumWarps( m_settings.m_numWarps );
+    main->tld->setLearningBudget( m_settings.m_learningConfidence, m_settings.m_maxLearningPositives,
+                                  m_settings.m_maxLearningNegatives, m_settings.m_maxLearningNegativesNN );
 
 	main->showOutput = m_settings.m_showOutput;
 	main->printResults = (m_settings.m_printResults.empty()) ? NULL : m_settings.m_printResults.c_str();
+	main->printTiming = (m_settings.m_printTiming.empty()) ? NULL : m_settings.m_printTiming.c_str();
 	main->saveDir = (m_settings.m_outputDir.empty()) ? NULL : m_settings.m_outputDir.c_str();
 	main->threshold = m_settings.m_threshold;
 	main->showForeground = m_settings.m_showForeground;
@@ -400,6 +451,7 @@ int Config::configure(Main* main) {
 	main->loadModel = m_settings.m_loadModel;
 	main->modelPath = (m_settings.m_modelPath.empty()) ? NULL : m_settings.m_modelPath.c_str();
 	main->seed = m_settings.m_seed;
+    main->tld->setSeed(m_settings.m_seed);
 	if(m_settings.m_initialBoundingBox.size() > 0) {
 		main->initialBB = new int[4];
 		for(int i = 0; i < 4; i++) {
@@ -407,6 +459,11 @@ int Config::configure(Main* main) {
 		}
 	}
 
+	//Replaces the NN classifier, so this has to come before its settings
+	if(!main->tld->setPatchSize(m_settings.m_patchSize)) {
+		printf("Warning: Unsupported patch size %d, using default\n", m_settings.m_patchSize);
+	}
+
     auto detectorCascade = main->tld->detector();
 	detectorCascade->varianceFilter->enabled = m_settings.m_varianceFilterEnabled;
 	detectorCascade->ensembleClassifier->enabled = m_settings.m_ensembleClassifierEnabled;
@@ -423,6 +480,10 @@ int Config::configure(Main* main) {
 	detectorCascade->nnClassifier->thetaTP = m_settings.m_thetaP;
 	detectorCascade->nnClassifier->thetaFP = m_settings.m_thetaN;
 
+	if(!detectorCascade->nnClassifier->setQuantization(m_settings.m_nnQuantization)) {
+		printf("Warning: Unsupported NN quantization %d, using %d\n", m_settings.m_nnQuantization, detectorCascade->nnClassifier->quantization);
+	}
+
 	return SUCCESS;
 }
 
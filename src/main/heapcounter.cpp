@@ -0,0 +1,119 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+/*
+ * heapcounter.cpp
+ *
+ * Counts heap allocations by wrapping the allocator of the C library with glibc,
+ * and by replacing the global operator new elsewhere. The wrappers must live in
+ * the executable, so that they also catch the allocations of shared libraries.
+ */
+
+#include "heapcounter.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define COUNT_MALLOC 1
+#endif
+
+static std::atomic<long> numAllocations(0);
+
+namespace tld {
+
+long heapAllocations() {
+	return numAllocations.load(std::memory_order_relaxed);
+}
+
+}
+
+#ifdef COUNT_MALLOC
+
+//The allocator of glibc under its internal names. operator new and free end up there as well.
+extern "C" {
+	void * __libc_malloc(size_t size);
+	void * __libc_calloc(size_t count, size_t size);
+	void * __libc_realloc(void * ptr, size_t size);
+	void * __libc_memalign(size_t alignment, size_t size);
+
+	void * malloc(size_t size) {
+		numAllocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_malloc(size);
+	}
+
+	void * calloc(size_t count, size_t size) {
+		numAllocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_calloc(count, size);
+	}
+
+	//Shrinking or freeing does not allocate, but realloc cannot tell, so it is always counted
+	void * realloc(void * ptr, size_t size) {
+		numAllocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_realloc(ptr, size);
+	}
+
+	void * memalign(size_t alignment, size_t size) {
+		numAllocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_memalign(alignment, size);
+	}
+
+	void * aligned_alloc(size_t alignment, size_t size) {
+		return memalign(alignment, size);
+	}
+
+	int posix_memalign(void ** ptr, size_t alignment, size_t size) {
+		void * mem = memalign(alignment, size);
+
+		if(mem == NULL) {
+			return ENOMEM;
+		}
+
+		*ptr = mem;
+		return 0;
+	}
+}
+
+#else
+
+void * operator new(size_t size) {
+	numAllocations.fetch_add(1, std::memory_order_relaxed);
+	void * mem = malloc(size > 0 ? size : 1);
+
+	if(mem == NULL) {
+		throw std::bad_alloc();
+	}
+
+	return mem;
+}
+
+void * operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void * ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete[](void * ptr) noexcept {
+	free(ptr);
+}
+
+#endif
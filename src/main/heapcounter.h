@@ -0,0 +1,36 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef HEAPCOUNTER_H_
+#define HEAPCOUNTER_H_
+
+namespace tld {
+
+/**
+ * Number of heap allocations made by the process so far, on all threads.
+ * With glibc, every malloc, calloc, realloc and aligned allocation is counted,
+ * which includes operator new and the buffers of OpenCV. Elsewhere, and in
+ * sanitizer builds, only operator new is counted.
+ * Sample it before and after a piece of work to get the allocations it made.
+ */
+long heapAllocations();
+
+}
+
+#endif /* HEAPCOUNTER_H_ */
@@ -29,8 +29,23 @@ Settings::Settings() :
 		m_nnClassifierEnabled(true),
 		m_loadModel(false),
 		m_trackerEnabled(true),
+		m_trackerPoints(0),
+		m_trackerObjectSize(0),
+		m_motionModel(false),
+		m_concurrentTracking(false),
+		m_nativeLK(false),
 		m_selectManually(false),
+		m_maxDetectionInterval(1),
+		m_detectionConfidence(0.7),
+		m_detectionMaxFbError(1),
+		m_detectionMaxMotion(0.1),
 		m_learningEnabled(true),
+		m_asyncLearning(false),
+		m_numWarps(20),
+		m_learningConfidence(1),
+		m_maxLearningPositives(10),
+		m_maxLearningNegatives(0),
+		m_maxLearningNegativesNN(0),
 		m_showOutput(true),
 		m_showNotConfident(true),
 		m_showColorImage(false),
@@ -49,6 +64,8 @@ Settings::Settings() :
 		m_numTrees(10),
 		m_thetaP(0.65),
 		m_thetaN(0.5),
+		m_nnQuantization(0),
+		m_patchSize(15),
 		m_minSize(25),
 		m_camNo(0),
 		m_fps(24),
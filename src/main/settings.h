@@ -36,13 +36,28 @@ public:
 	Settings();
 	~Settings();
 	bool m_trackerEnabled;
+	int m_trackerPoints; //!< budget of points tracked by the median flow tracker; 0 tracks a fixed 10x10 grid
+	int m_trackerObjectSize; //!< the tracker runs on a crop around the object, downscaled to at most this object size; 0 tracks on the full frames
+	bool m_motionModel; //!< the tracker predicts the motion of the object to seed Lucas-Kanade and to use fewer pyramid levels
+	bool m_concurrentTracking; //!< the tracker runs on its own thread while the detector scans the frame
+	bool m_nativeLK; //!< the tracker uses its own fixed-point Lucas-Kanade kernel instead of the one of OpenCV
 	bool m_varianceFilterEnabled;
 	bool m_ensembleClassifierEnabled;
 	bool m_nnClassifierEnabled;
 	bool m_useProportionalShift; //!< sets scanwindows off by a percentage value of the window dimensions (specified in proportionalShift) rather than 1px.
 	bool m_loadModel; //!< if true, model specified by "modelPath" is loaded at startup
 	bool m_selectManually; //!< if true, user can select initial bounding box (which then overrides the setting "initialBoundingBox")
+	int m_maxDetectionInterval; //!< upper limit of the frames from one full detector scan to the next, in between the detector only verifies the tracker; 1 scans every frame
+	float m_detectionConfidence; //!< the detection interval only grows while the tracker confidence is at least this
+	float m_detectionMaxFbError; //!< ... the forward-backward error of the tracker is at most this many pixels
+	float m_detectionMaxMotion; //!< ... and the object moves by at most this fraction of its size per frame
 	bool m_learningEnabled; //!< enables learning while processing
+	bool m_asyncLearning; //!< learning runs on a background thread, the detector uses the new model from the next frame on
+	int m_numWarps; //!< number of warped copies of the positive windows learned at initialisation
+	float m_learningConfidence; //!< above this confidence, frames are only learned if tracker and detector disagree
+	int m_maxLearningPositives; //!< positive windows learned per frame; 0 means no limit
+	int m_maxLearningNegatives; //!< negative windows learned by the ensemble classifier per frame, the hardest are kept; 0 means no limit. Without the ensemble classifier, the first windows in scan order are kept
+	int m_maxLearningNegativesNN; //!< negative windows learned by the NN classifier per frame, ranked like m_maxLearningNegatives; 0 means no limit
 	bool m_showOutput; //!< creates a window displaying results
 	bool m_showNotConfident; //!< show bounding box also if confidence is low
 	bool m_showColorImage; //!< shows color images instead of greyscale
@@ -61,6 +76,8 @@ public:
 	int m_numTrees; //!< number of trees
 	float m_thetaP;
 	float m_thetaN;
+	int m_nnQuantization; //!< 0 stores NN samples as floats, 8 or 16 quantizes them to int8/int16
+	int m_patchSize; //!< side length of the NN patches: 10, 15 or 20
 	int m_seed;
 	int m_minSize; //!< minimum size of scanWindows
 	int m_camNo; //!< Which camera to use
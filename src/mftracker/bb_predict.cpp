@@ -49,23 +49,42 @@ float getBbHeight(float* bb)
 {
   return abs(bb[3] - bb[1] + 1);
 }
+/**
+ * Maximum number of point pairs used for the scale estimation. Covers all
+ * pairs of the 10x10 grid; larger point sets use a subset of pairs.
+ */
+#define MAX_PAIRS 4950
+/**
+ * Squared relative change of the distance between the points i and j.
+ */
+static float squaredDistanceRatio(CvPoint2D32f* pt0, CvPoint2D32f* pt1,
+    int i, int j)
+{
+  float dx0 = pt0[i].x - pt0[j].x;
+  float dy0 = pt0[i].y - pt0[j].y;
+  float dx1 = pt1[i].x - pt1[j].x;
+  float dy1 = pt1[i].y - pt1[j].y;
+  return (dx1 * dx1 + dy1 * dy1) / (dx0 * dx0 + dy0 * dy0);
+}
 /**
  * Calculates the new (moved and resized) Bounding box.
  * Calculation based on all relative distance changes of all points
  * to every point. Then the Median of the relative Values is used.
+ * The median is taken over squared ratios, which have the same order,
+ * so only one square root is needed. If there are more than MAX_PAIRS
+ * pairs, a fixed pseudo random subset of MAX_PAIRS pairs is used.
  */
 int predictbb(float *bb0, CvPoint2D32f* pt0, CvPoint2D32f* pt1, int nPts,
-    float *bb1, float* shift)
+    float *bb1, float* shift, ScratchArena *scratch)
 {
-  float* ofx = (float*) malloc(sizeof(float) * nPts);
-  float* ofy = (float*) malloc(sizeof(float) * nPts);
+  float* ofx = (float*) scratchAlloc(scratch, sizeof(float) * nPts);
+  float* ofy = (float*) scratchAlloc(scratch, sizeof(float) * nPts);
   int i;
   int j;
   int d = 0;
   float dx,dy;
   int lenPdist;
-  float* dist0;
-  float* dist1;
+  float *ratios;
   float s0,s1;
   for (i = 0; i < nPts; i++)
   {
@@ -74,32 +93,38 @@ int predictbb(float *bb0, CvPoint2D32f* pt0, CvPoint2D32f* pt1, int nPts,
   }
   dx = getMedianUnmanaged(ofx, nPts);
   dy = getMedianUnmanaged(ofy, nPts);
-  free(ofx);
-  ofx = 0;
-  free(ofy);
-  ofy = 0;
   //m(m-1)/2
   lenPdist = nPts * (nPts - 1) / 2;
-  dist0 = (float*) malloc(sizeof(float) * lenPdist);
-  dist1 = (float*) malloc(sizeof(float) * lenPdist);
-  for (i = 0; i < nPts; i++)
+  ratios = (float*) scratchAlloc(scratch, sizeof(float) * MIN(lenPdist, MAX_PAIRS));
+  if (lenPdist <= MAX_PAIRS)
+  {
+    for (i = 0; i < nPts; i++)
+    {
+      for (j = i + 1; j < nPts; j++, d++)
+      {
+        ratios[d] = squaredDistanceRatio(pt0, pt1, i, j);
+      }
+    }
+  }
+  else
   {
-    for (j = i + 1; j < nPts; j++, d++)
+    //Same subset every call, so the result is deterministic
+    unsigned int state = 1;
+    lenPdist = MAX_PAIRS;
+    for (d = 0; d < lenPdist; d++)
     {
-      dist0[d]
-          = sqrt(pow(pt0[i].x - pt0[j].x, 2) + pow(pt0[i].y - pt0[j].y, 2));
-      dist1[d]
-          = sqrt(pow(pt1[i].x - pt1[j].x, 2) + pow(pt1[i].y - pt1[j].y, 2));
-      dist0[d] = dist1[d] / dist0[d];
+      state = state * 1664525u + 1013904223u;
+      i = (state >> 8) % nPts;
+      state = state * 1664525u + 1013904223u;
+      j = (state >> 8) % (nPts - 1);
+      if (j >= i)
+        j++;
+      ratios[d] = squaredDistanceRatio(pt0, pt1, i, j);
     }
   }
   //The scale change is the median of all changes of distance.
   //same as s = median(d2./d1) with above
-  *shift = getMedianUnmanaged(dist0, lenPdist);
-  free(dist0);
-  dist0 = 0;
-  free(dist1);
-  dist1 = 0;
+  *shift = sqrt(getMedianUnmanaged(ratios, lenPdist));
   s0 = 0.5 * (*shift - 1) * getBbWidth(bb0);
   s1 = 0.5 * (*shift - 1) * getBbHeight(bb0);
 
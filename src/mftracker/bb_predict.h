@@ -35,6 +35,7 @@
  * INCLUDES
  ***********************************************************/
 #include <opencv/cv.h>
+#include "scratch.h"
 /***********************************************************
  * CONSTANT AND MACRO DEFINITIONS
  ***********************************************************/
@@ -56,9 +57,10 @@
  *              1 == no scalechange, experience: if shift == 0
  *              BoundingBox moved completely out of picture
  *              (not validated)
+ * @param scratch Arena for the temporary buffers.
  */
 int predictbb(float *bb0, CvPoint2D32f* pt0, CvPoint2D32f* pt1, int nPts,
-    float*bb1, float*shift);
+    float*bb1, float*shift, ScratchArena *scratch);
 
 /***********************************************************
  * EPILOGUE
@@ -32,62 +32,207 @@
 #include "median.h"
 #include "stdio.h"
 #include "lk.h"
+#include <algorithm>
+
+/***********************************************************
+ * CONSTANT AND MACRO DEFINITIONS
+ ***********************************************************/
+/**
+ * Minimum distance in pixels between selected points, limits the number of
+ * points on small objects.
+ */
+const int MIN_POINT_SPACING = 4;
+/**
+ * Lower limit of the number of points, the medians get unstable below.
+ */
+const int MIN_POINTS = 16;
+/**
+ * Number of candidate locations scored per selected point.
+ */
+const int CANDIDATES_PER_POINT = 4;
 
 /***********************************************************
  * FUNCTION
  ***********************************************************/
 
+/**
+ * Smaller eigenvalue of the gradient structure tensor in the 3x3
+ * neighbourhood of a point. Large for corners, small in flat regions
+ * and along edges, where LK is unreliable.
+ */
+static float textureScore(IplImage *img, float px, float py)
+{
+  const unsigned char *data = (const unsigned char *) img->imageData;
+  int step = img->widthStep;
+  float gxx = 0, gxy = 0, gyy = 0;
+  int x, y, dx, dy;
+
+  if (img->width < 5 || img->height < 5)
+  {
+    return 0;
+  }
+
+  x = MIN(MAX(cvRound(px), 2), img->width - 3);
+  y = MIN(MAX(cvRound(py), 2), img->height - 3);
+
+  for (dy = -1; dy <= 1; dy++)
+  {
+    for (dx = -1; dx <= 1; dx++)
+    {
+      const unsigned char *p = data + (y + dy) * step + x + dx;
+      float gx = p[1] - p[-1];
+      float gy = p[step] - p[-step];
+      gxx += gx * gx;
+      gxy += gx * gy;
+      gyy += gy * gy;
+    }
+  }
+
+  return 0.5f * (gxx + gyy - sqrt((gxx - gyy) * (gxx - gyy) + 4 * gxy * gxy));
+}
+
+typedef struct
+{
+  float score;
+  int index;
+} ScoredPoint;
+
+/**
+ * Orders by descending score, ties by ascending index.
+ */
+static bool scoredPointBefore(const ScoredPoint &a, const ScoredPoint &b)
+{
+  if (a.score != b.score)
+    return a.score > b.score;
+  return a.index < b.index;
+}
+
+/**
+ * Selects the points to track: the best textured locations out of a grid
+ * of candidates on the bounding box. The number of points grows with the
+ * size of the box up to maxPoints.
+ * @param img        Image the points are selected in.
+ * @param bb         Bounding box, format x1,y1,x2,y2
+ * @param maxPoints  Budget of points.
+ * @param margin     margin (in pixel)
+ * @param pts        Output: array of at least maxPoints * 2 floats (x1, y1, x2, y2).
+ * @param scratch    Arena for the candidates.
+ * @return           Number of selected points.
+ */
+static int selectBBPoints(IplImage *img, float *bb, int maxPoints, int margin,
+    float *pts, ScratchArena *scratch)
+{
+  float width = MAX(bb[2] - bb[0] + 1 - 2 * margin, 0.f);
+  float height = MAX(bb[3] - bb[1] + 1 - 2 * margin, 0.f);
+  int nPoints = (int) (width * height / (MIN_POINT_SPACING * MIN_POINT_SPACING));
+  int side;
+  int nCandidates;
+  float *candidates;
+  ScoredPoint *scored;
+  int i;
+
+  nPoints = MIN(MAX(nPoints, MIN_POINTS), maxPoints);
+  side = (int) ceil(sqrt((float) nPoints * CANDIDATES_PER_POINT));
+  nCandidates = side * side;
+
+  candidates = (float*) scratchAlloc(scratch, sizeof(float) * nCandidates * 2);
+  scored = (ScoredPoint*) scratchAlloc(scratch, sizeof(ScoredPoint) * nCandidates);
+  getFilledBBPoints(bb, side, side, margin, &candidates);
+
+  for (i = 0; i < nCandidates; i++)
+  {
+    scored[i].score = textureScore(img, candidates[2 * i], candidates[2 * i + 1]);
+    scored[i].index = i;
+  }
+
+  /* Only the selected points are ordered. Unlike qsort, this never allocates. */
+  std::partial_sort(scored, scored + nPoints, scored + nCandidates, scoredPointBefore);
+
+  for (i = 0; i < nPoints; i++)
+  {
+    pts[2 * i] = candidates[2 * scored[i].index];
+    pts[2 * i + 1] = candidates[2 * scored[i].index + 1];
+  }
+
+  return nPoints;
+}
+
 /**
  * Calculate the bounding box of an Object in a following Image.
  * Imgs aren't changed.
+ * @param cache      Pyramid cache of the tracker instance, see LKCache
  * @param imgI       Image contain Object with known BoundingBox
  * @param imgJ       Following Image.
  * @param bb         Bounding box of object to track in imgI.
  *                   Format x1,y1,x2,y2
  * @param scaleshift returns relative scale change of bb
+ * @param fbError    returns the median forward-backward error of the tracked
+ *                   points in pixels of imgI. May be NULL.
+ * @param maxPoints  Budget of tracked points, which are placed on textured
+ *                   locations of imgI. 0 tracks a fixed 10x10 grid.
+ * @param motion     Predicted displacement (x,y) of the object, the initial
+ *                   guess of every point. 0 starts from the previous positions.
+ * @param level      Highest pyramid level used by LK, 5 if -1.
+ * @param scratch    Arena for the temporary buffers, reset by the caller.
  */
-int fbtrack(IplImage *imgI, IplImage *imgJ, float* bb, float* bbnew,
-    float* scaleshift)
+int fbtrack(LKCache *cache, IplImage *imgI, IplImage *imgJ, float* bb, float* bbnew,
+    float* scaleshift, float *fbError, int maxPoints, const float *motion, int level,
+    ScratchArena *scratch)
 {
-  char level = 5;
   int numM = 10;
   int numN = 10;
-  int nPoints = numM * numN;
+  int nPoints = maxPoints > 0 ? maxPoints : numM * numN;
   int sizePointsArray = nPoints * 2;
 
-  float* fb = (float*) malloc(nPoints * sizeof(float));
-  float* ncc = (float*) malloc(nPoints * sizeof(float));
-  char* status = (char*) malloc(nPoints);
+  float* fb = (float*) scratchAlloc(scratch, nPoints * sizeof(float));
+  float* ncc = (float*) scratchAlloc(scratch, nPoints * sizeof(float));
+  char* status = (char*) scratchAlloc(scratch, nPoints);
 
-  float * pt = (float*) malloc(sizeof(float) * sizePointsArray);
-  float * ptTracked = (float*) malloc(sizeof(float) * sizePointsArray);
+  float * pt = (float*) scratchAlloc(scratch, sizeof(float) * sizePointsArray);
+  float * ptTracked = (float*) scratchAlloc(scratch, sizeof(float) * sizePointsArray);
   int nlkPoints;
   CvPoint2D32f* startPoints;
   CvPoint2D32f* targetPoints;
   float *fbLkCleaned;
   float *nccLkCleaned;
+  float *medianBuffer;
   int i,M;
   int nRealPoints;
   float medFb;
   float medNcc;
   int nAfterFbUsage;
-  getFilledBBPoints(bb, numM, numN, 5, &pt);
+  if (maxPoints > 0)
+  {
+    nPoints = selectBBPoints(imgI, bb, maxPoints, 5, pt, scratch);
+    sizePointsArray = nPoints * 2;
+  }
+  else
+  {
+    getFilledBBPoints(bb, numM, numN, 5, &pt);
+  }
   //getFilledBBPoints(bb, numM, numN, 5, &ptTracked);
   memcpy(ptTracked, pt, sizeof(float) * sizePointsArray);
+  if (motion != 0)
+  {
+    for (i = 0; i < nPoints; i++)
+    {
+      ptTracked[2 * i] += motion[0];
+      ptTracked[2 * i + 1] += motion[1];
+    }
+  }
 
-  initImgs();
-  trackLK(imgI, imgJ, pt, nPoints, ptTracked, nPoints, level, fb, ncc, status);
-  initImgs();
+  trackLK(cache, imgI, imgJ, pt, nPoints, ptTracked, nPoints, level, fb, ncc, status,
+      scratch);
   //  char* status = *statusP;
   nlkPoints = 0;
   for (i = 0; i < nPoints; i++)
   {
     nlkPoints += status[i];
   }
-  startPoints = (CvPoint2D32f*) malloc(nlkPoints * sizeof(CvPoint2D32f));
-  targetPoints = (CvPoint2D32f*) malloc(nlkPoints * sizeof(CvPoint2D32f));
-  fbLkCleaned = (float*) malloc(nlkPoints * sizeof(float));
-  nccLkCleaned = (float*) malloc(nlkPoints * sizeof(float));
+  startPoints = (CvPoint2D32f*) scratchAlloc(scratch, nlkPoints * sizeof(CvPoint2D32f));
+  targetPoints = (CvPoint2D32f*) scratchAlloc(scratch, nlkPoints * sizeof(CvPoint2D32f));
+  fbLkCleaned = (float*) scratchAlloc(scratch, nlkPoints * sizeof(float));
+  nccLkCleaned = (float*) scratchAlloc(scratch, nlkPoints * sizeof(float));
 
   M = 2;
   nRealPoints = 0;
@@ -110,11 +255,13 @@ int fbtrack(IplImage *imgI, IplImage *imgJ, float* bb, float* bbnew,
       nRealPoints++;
     }
   }
-  free(pt);
-  free(ptTracked);
   //assert nRealPoints==nlkPoints
-  medFb = getMedian(fbLkCleaned, nlkPoints);
-  medNcc = getMedian(nccLkCleaned, nlkPoints);
+  //The medians reorder their input, so they work on copies
+  medianBuffer = (float*) scratchAlloc(scratch, nlkPoints * sizeof(float));
+  memcpy(medianBuffer, fbLkCleaned, nlkPoints * sizeof(float));
+  medFb = getMedianUnmanaged(medianBuffer, nlkPoints);
+  memcpy(medianBuffer, nccLkCleaned, nlkPoints * sizeof(float));
+  medNcc = getMedianUnmanaged(medianBuffer, nlkPoints);
   /*  printf("medianfb: %f\nmedianncc: %f\n", medFb, medNcc);
    printf("Number of points after lk: %d\n", nlkPoints);*/
   nAfterFbUsage = 0;
@@ -134,19 +281,18 @@ int fbtrack(IplImage *imgI, IplImage *imgJ, float* bb, float* bbnew,
   //      nRealPoints);
   //  showIplImage(imgI);
 
-  predictbb(bb, startPoints, targetPoints, nAfterFbUsage, bbnew, scaleshift);
+  predictbb(bb, startPoints, targetPoints, nAfterFbUsage, bbnew, scaleshift,
+      scratch);
   /*printf("bbnew: %f,%f,%f,%f\n", bbnew[0], bbnew[1], bbnew[2], bbnew[3]);
    printf("relative scale: %f \n", scaleshift[0]);*/
   //show picture with tracked bb
   //  drawRectFromBB(imgJ, bbnew);
   //  showIplImage(imgJ);
-  free(fb);
-  free(ncc);
-  free(status);
-  free(startPoints);
-  free(targetPoints);
-  free(fbLkCleaned);
-  free(nccLkCleaned);
+
+  if (fbError != 0)
+  {
+    *fbError = medFb;
+  }
 
   if(medFb > 10) return 0;
   else return 1;
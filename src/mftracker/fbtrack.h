@@ -29,18 +29,28 @@
  * INCLUDES
  ***********************************************************/
 #include <opencv/cv.h>
+#include "lk.h"
 
 /***********************************************************
  * FUNCTION
  ***********************************************************/
 /*
+ * @param cache      Pyramid cache of the tracker instance, see LKCache
  * @param imgI       Image contain Object with known BoundingBox
  * @param imgJ       Following Image.
  * @param bb         Bounding box of object to track in imgI.
  *                   Format x1,y1,x2,y2
  * @param scaleshift returns relative scale change of bb
+ * @param fbError    returns the median forward-backward error of the tracked
+ *                   points in pixels of imgI. May be NULL.
+ * @param maxPoints  Budget of tracked points, which are placed on textured
+ *                   locations of imgI. 0 tracks a fixed 10x10 grid.
+ * @param motion     Predicted displacement (x,y) of the object, the initial
+ *                   guess of every point. 0 starts from the previous positions.
+ * @param level      Highest pyramid level used by LK, 5 if -1.
+ * @param scratch    Arena for the temporary buffers, reset by the caller.
  */
-int fbtrack(IplImage *imgI, IplImage *imgJ, float* bb, float* bbnew, float* scaleshift);
+int fbtrack(LKCache *cache, IplImage *imgI, IplImage *imgJ, float* bb, float* bbnew, float* scaleshift, float *fbError, int maxPoints, const float *motion, int level, ScratchArena *scratch);
 
 #endif /* FBTRACK_H_ */
 /***********************************************************
@@ -37,15 +37,13 @@
  * CONSTANT AND MACRO DEFINITIONS
  ***********************************************************/
 
-const int MAX_COUNT = 500;
-const int MAX_IMG = 2;
+const int MAX_NCC_WINSIZE = 32;
 const double N_A_N = -1.0;
 /**
- * Size of the search window of each pyramid level in cvCalcOpticalFlowPyrLK.
+ * Size of the search window of each pyramid level in cv::calcOpticalFlowPyrLK,
+ * the same as in the native kernel.
  */
-int win_size_lk = 4;
-CvPoint2D32f* points[3] = { 0, 0, 0 };
-static IplImage **PYR = 0;
+const int WIN_SIZE_LK = LK_WIN_SIZE;
 
 /***********************************************************
  * FUNCTION
@@ -68,8 +66,95 @@ void euclideanDistance(CvPoint2D32f *point1, CvPoint2D32f *point2,
         + (point1[i].y - point2[i].y) * (point1[i].y - point2[i].y));
   }
 }
+/**
+ * Samples a winsize x winsize patch centered at point, like cvGetRectSubPix
+ * with an 8 bit destination: bilinear interpolation, rounded to integers,
+ * border pixels are replicated.
+ */
+static void getRectSubPix(IplImage *img, CvPoint2D32f point, int winsize,
+    float *patch)
+{
+  const unsigned char *data = (const unsigned char *) img->imageData;
+  int step = img->widthStep;
+  float x = point.x - (winsize - 1) * 0.5f;
+  float y = point.y - (winsize - 1) * 0.5f;
+  int ix = cvFloor(x);
+  int iy = cvFloor(y);
+  float a = x - ix;
+  float b = y - iy;
+  float a11 = (1.f - a) * (1.f - b);
+  float a12 = a * (1.f - b);
+  float a21 = (1.f - a) * b;
+  float a22 = a * b;
+  int cols[2 * MAX_NCC_WINSIZE];
+  int i, j;
+
+  /* Clamped column indices of the left and right neighbours */
+  for (j = 0; j < winsize; j++)
+  {
+    cols[2 * j] = MIN(MAX(ix + j, 0), img->width - 1);
+    cols[2 * j + 1] = MIN(MAX(ix + j + 1, 0), img->width - 1);
+  }
+
+  for (i = 0; i < winsize; i++)
+  {
+    const unsigned char *row0 = data
+        + step * MIN(MAX(iy + i, 0), img->height - 1);
+    const unsigned char *row1 = data
+        + step * MIN(MAX(iy + i + 1, 0), img->height - 1);
+    float *out = patch + i * winsize;
+
+    for (j = 0; j < winsize; j++)
+    {
+      out[j] = (float) cvRound(row0[cols[2 * j]] * a11 + row0[cols[2 * j + 1]] * a12
+          + row1[cols[2 * j]] * a21 + row1[cols[2 * j + 1]] * a22);
+    }
+  }
+}
+
+/**
+ * Correlation coefficient of two patches, as cvMatchTemplate with
+ * CV_TM_CCOEFF_NORMED on patches of equal size. 0 if a patch is constant.
+ */
+static float correlationCoefficient(const float *p0, const float *p1, int n)
+{
+  float mean0 = 0, mean1 = 0;
+  float sq0 = 0, sq1 = 0, prod = 0;
+  float norm;
+  int i;
+
+  /* Plain reductions, so that the compiler can vectorize them. The means are
+   * subtracted before squaring to avoid cancellation on flat patches. */
+  for (i = 0; i < n; i++)
+  {
+    mean0 += p0[i];
+    mean1 += p1[i];
+  }
+  mean0 /= n;
+  mean1 /= n;
+
+  for (i = 0; i < n; i++)
+  {
+    float d0 = p0[i] - mean0;
+    float d1 = p1[i] - mean1;
+    sq0 += d0 * d0;
+    sq1 += d1 * d1;
+    prod += d0 * d1;
+  }
+
+  norm = sqrt(sq0 * sq1);
+
+  if (norm <= 0)
+  {
+    return 0.0;
+  }
+
+  return MIN(MAX(prod / norm, -1.f), 1.f);
+}
+
 /**
  * Calculates normalized cross correlation for every point.
+ * All patches are sampled first and then correlated in a second pass.
  * @param imgI      Image 1.
  * @param imgJ      Image 2.
  * @param points0   Array of points of imgI
@@ -81,63 +166,94 @@ void euclideanDistance(CvPoint2D32f *point1, CvPoint2D32f *point2,
  * @param match     Output: Array will contain ncc values.
  *                  0.0 if not calculated.
  * @param winsize   Size of quadratic area around the point
- *                  which is compared.
- * @param method    Specifies the way how image regions are compared.
- *                  see cvMatchTemplate
+ *                  which is compared. At most MAX_NCC_WINSIZE.
+ * @param scratch   Arena for the sampled patches.
  */
 void normCrossCorrelation(IplImage *imgI, IplImage *imgJ,
     CvPoint2D32f *points0, CvPoint2D32f *points1, int nPts, char *status,
-    float *match, int winsize, int method)
+    float *match, int winsize, ScratchArena *scratch)
 {
-  IplImage *rec0 = cvCreateImage(cvSize(winsize, winsize), 8, 1);
-  IplImage *rec1 = cvCreateImage(cvSize(winsize, winsize), 8, 1);
-  IplImage *res = cvCreateImage(cvSize(1, 1), IPL_DEPTH_32F, 1);
+  int patchSize = winsize * winsize;
+  float *patches0 = (float*) scratchAlloc(scratch, nPts * patchSize * sizeof(float));
+  float *patches1 = (float*) scratchAlloc(scratch, nPts * patchSize * sizeof(float));
 
   int i;
   for (i = 0; i < nPts; i++)
   {
     if (status[i] == 1)
     {
-      cvGetRectSubPix(imgI, rec0, points0[i]);
-      cvGetRectSubPix(imgJ, rec1, points1[i]);
-      cvMatchTemplate(rec0, rec1, res, method);
-      match[i] = ((float *) (res->imageData))[0];
+      getRectSubPix(imgI, points0[i], winsize, patches0 + i * patchSize);
+      getRectSubPix(imgJ, points1[i], winsize, patches1 + i * patchSize);
+    }
+  }
+
+  for (i = 0; i < nPts; i++)
+  {
+    if (status[i] == 1)
+    {
+      match[i] = correlationCoefficient(patches0 + i * patchSize,
+          patches1 + i * patchSize, patchSize);
     }
     else
     {
       match[i] = 0.0;
     }
   }
-  cvReleaseImage(&rec0);
-  cvReleaseImage(&rec1);
-  cvReleaseImage(&res);
 }
 /**
- * Needed before start of trackLK and at the end of the program for cleanup.
- * Handles PYR(Pyramid cache) variable.
+ * Needed before the first call of trackLK.
  */
-void initImgs()
+void initLKCache(LKCache *cache)
 {
-  if (PYR != 0)
+  cache->pyr[0].clear();
+  cache->pyr[1].clear();
+  cache->current = 0;
+  cache->image = 0;
+  cache->level = 0;
+  initLKPyramid(&cache->native[0]);
+  initLKPyramid(&cache->native[1]);
+  cache->useNative = 0;
+  cache->built = 0;
+  cache->reused = 0;
+}
+
+/**
+ * Frees the pyramid buffers. The cache can be used again afterwards.
+ */
+void releaseLKCache(LKCache *cache)
+{
+  int useNative = cache->useNative;
+  long built = cache->built;
+  long reused = cache->reused;
+  int i;
+  for (i = 0; i < 2; i++)
   {
-    int i;
-    for (i = 0; i < MAX_IMG; i++)
-    {
-      cvReleaseImage(&(PYR[i]));
-      PYR[i] = 0;
-    }
-    free(PYR);
-    PYR = 0;
-    //printf("LK: deallocated\n");
+    releaseLKPyramid(&cache->native[i]);
   }
-  PYR = (IplImage**) calloc(MAX_IMG, sizeof(IplImage*));
-  //printf("LK: initialized\n");
+  initLKCache(cache);
+  cache->useNative = useNative;
+  cache->built = built;
+  cache->reused = reused;
+}
+
+/**
+ * Forgets the cached pyramid but keeps the buffers. Needed if the next
+ * imgI may share its imageData with the last imgJ but has other contents,
+ * e.g. when tracking on crops of the frames, or if useNative was changed.
+ */
+void invalidateLKCache(LKCache *cache)
+{
+  cache->image = 0;
 }
 
 /**
  * Tracks Points from 1.Image to 2.Image.
- * Need initImgs before start and at the end of the program for cleanup.
+ * Need initLKCache before start and releaseLKCache at the end for cleanup.
+ * All state is kept in cache, so trackers with different caches can run concurrently.
+ * The caller must keep imgJ alive until the next call, otherwise a new image
+ * at the same address would be mistaken for it.
  *
+ * @param cache     Pyramid cache, see LKCache.
  * @param imgI      previous Image source. (isn't changed)
  * @param imgJ      actual Image target. (isn't changed)
  * @param ptsI      points to track from first Image.
@@ -153,13 +269,15 @@ void initImgs()
  * @param ncc       normCrossCorrelation values. needs as inputlength nPtsI * sizeof(float)
  * @param status    Indicates positive tracks. 1 = PosTrack 0 = NegTrack
  *                  needs as inputlength nPtsI * sizeof(char)
+ * @param scratch   Arena for the temporary buffers.
  *
  *
  * Based Matlab function:
  * lk(2,imgI,imgJ,ptsI,ptsJ,Level) (Level is optional)
  */
-int trackLK(IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
-    float ptsJ[], int nPtsJ, int level, float * fb, float*ncc, char*status)
+int trackLK(LKCache *cache, IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
+    float ptsJ[], int nPtsJ, int level, float * fb, float*ncc, char*status,
+    ScratchArena *scratch)
 {
   //TODO: watch NaN cases
   //double nan = std::numeric_limits<double>::quiet_NaN();
@@ -167,21 +285,24 @@ int trackLK(IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
 
   // tracking
   int I, J, winsize_ncc;
-  CvSize pyr_sz;
   int i;
+  int pyrAReady;
+  CvPoint2D32f* points[3];
   //if unused std 5
   if (level == -1)
   {
     level = 5;
   }
-  I = 0;
-  J = 1;
   winsize_ncc = 10;
 
-  //NOTE: initImgs() must be used correctly or memleak will follow.
-  pyr_sz = cvSize(imgI->width + 8, imgI->height / 3);
-  PYR[I] = cvCreateImage(pyr_sz, IPL_DEPTH_32F, 1);
-  PYR[J] = cvCreateImage(pyr_sz, IPL_DEPTH_32F, 1);
+  //The pyramid of imgI is still there if it was imgJ of the previous call,
+  //and is usable if it has enough levels
+  pyrAReady = (cache->image != 0 && cache->image == imgI->imageData
+      && cache->level >= level);
+  I = pyrAReady ? cache->current : 0;
+  J = 1 - I;
+  cache->built += pyrAReady ? 1 : 2;
+  cache->reused += pyrAReady ? 1 : 0;
 
   // Points
   if (nPtsJ != nPtsI)
@@ -190,11 +311,10 @@ int trackLK(IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
     return 0;
   }
 
-  points[0] = (CvPoint2D32f*) malloc(nPtsI * sizeof(CvPoint2D32f)); // template
-  points[1] = (CvPoint2D32f*) malloc(nPtsI * sizeof(CvPoint2D32f)); // target
-  points[2] = (CvPoint2D32f*) malloc(nPtsI * sizeof(CvPoint2D32f)); // forward-backward
-  //TODO:Free
-  char* statusBacktrack = (char*) malloc(nPtsI);
+  points[0] = (CvPoint2D32f*) scratchAlloc(scratch, nPtsI * sizeof(CvPoint2D32f)); // template
+  points[1] = (CvPoint2D32f*) scratchAlloc(scratch, nPtsI * sizeof(CvPoint2D32f)); // target
+  points[2] = (CvPoint2D32f*) scratchAlloc(scratch, nPtsI * sizeof(CvPoint2D32f)); // forward-backward
+  char* statusBacktrack = (char*) scratchAlloc(scratch, nPtsI);
 
   for (i = 0; i < nPtsI; i++)
   {
@@ -206,17 +326,56 @@ int trackLK(IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
     points[2][i].y = ptsI[2 * i + 1];
   }
 
-  //lucas kanade track
-  cvCalcOpticalFlowPyrLK(imgI, imgJ, PYR[I], PYR[J], points[0], points[1],
-      nPtsI, cvSize(win_size_lk, win_size_lk), level, status, 0, cvTermCriteria(
-          CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 20, 0.03),
-      CV_LKFLOW_INITIAL_GUESSES);
+  if (cache->useNative)
+  {
+    //Both pyramids are built with all levels, so that they can be reused
+    //whatever level is requested
+    if (!pyrAReady)
+    {
+      buildLKPyramid(&cache->native[I], imgI, LK_MAX_LEVELS - 1);
+    }
+    buildLKPyramid(&cache->native[J], imgJ, LK_MAX_LEVELS - 1);
+
+    //Forward and backward pass share the pyramids and derivatives
+    trackLKPyramid(&cache->native[I], &cache->native[J], points[0], points[1],
+        nPtsI, level, status);
+    trackLKPyramid(&cache->native[J], &cache->native[I], points[1], points[2],
+        nPtsI, level, statusBacktrack);
+
+    cache->current = J;
+    cache->image = imgJ->imageData;
+    cache->level = LK_MAX_LEVELS - 1;
+  }
+  else
+  {
+    cv::Size winSize(WIN_SIZE_LK, WIN_SIZE_LK);
+    cv::TermCriteria criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, 0.03);
+    cv::Mat pts0(nPtsI, 1, CV_32FC2, points[0]);
+    cv::Mat pts1(nPtsI, 1, CV_32FC2, points[1]);
+    cv::Mat pts2(nPtsI, 1, CV_32FC2, points[2]);
+    cv::Mat forwardStatus(nPtsI, 1, CV_8U, status);
+    cv::Mat backwardStatus(nPtsI, 1, CV_8U, statusBacktrack);
+
+    //The pyramids keep their buffers, so images of constant size don't reallocate them
+    if (!pyrAReady)
+    {
+      cv::buildOpticalFlowPyramid(cv::Mat(imgI), cache->pyr[I], winSize, level);
+    }
+    cv::buildOpticalFlowPyramid(cv::Mat(imgJ), cache->pyr[J], winSize, level);
+
+    //lucas kanade track
+    cv::calcOpticalFlowPyrLK(cache->pyr[I], cache->pyr[J], pts0, pts1, forwardStatus,
+        cv::noArray(), winSize, level, criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
 
-  //backtrack
-  cvCalcOpticalFlowPyrLK(imgJ, imgI, PYR[J], PYR[I], points[1], points[2],
-      nPtsI, cvSize(win_size_lk, win_size_lk), level, statusBacktrack, 0, cvTermCriteria(
-          CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, 20, 0.03),
-      CV_LKFLOW_INITIAL_GUESSES | CV_LKFLOW_PYR_A_READY | CV_LKFLOW_PYR_B_READY);
+    //Keep the pyramid of imgJ for the next call
+    cache->current = J;
+    cache->image = imgJ->imageData;
+    cache->level = level;
+
+    //backtrack
+    cv::calcOpticalFlowPyrLK(cache->pyr[J], cache->pyr[I], pts1, pts2, backwardStatus,
+        cv::noArray(), winSize, level, criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+  }
 
     for (i = 0; i < nPtsI; i++)
     {
@@ -228,7 +387,7 @@ int trackLK(IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
       }
     }
   normCrossCorrelation(imgI, imgJ, points[0], points[1], nPtsI, status, ncc,
-      winsize_ncc, CV_TM_CCOEFF_NORMED);
+      winsize_ncc, scratch);
   euclideanDistance(points[0], points[2], fb, nPtsI);
 
   for (i = 0; i < nPtsI; i++)
@@ -247,12 +406,6 @@ int trackLK(IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
       ncc[i] = N_A_N;
     }
   }
-  for (i = 0; i < 3; i++)
-  {
-    free(points[i]);
-    points[i] = 0;
-  }
-  free(statusBacktrack);
   return 1;
 }
 
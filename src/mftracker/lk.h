@@ -35,6 +35,9 @@
  ***********************************************************/
 
 #include "opencv/cv.h"
+#include <vector>
+#include "lkfixed.h"
+#include "scratch.h"
 
 /***********************************************************
  * CONSTANT AND MACRO DEFINITIONS
@@ -43,6 +46,22 @@
 /***********************************************************
  * DATA DEFINITIONS
  ***********************************************************/
+/**
+ * Pyramid cache of trackLK, one per tracker instance.
+ * The pyramid of the second image of a call is kept and reused as the
+ * pyramid of the first image of the next call, if that is the same image.
+ */
+typedef struct
+{
+  std::vector<cv::Mat> pyr[2]; /* Pyramids of cv::buildOpticalFlowPyramid */
+  int current;        /* Index of the pyramid of image */
+  const char *image;  /* imageData of the image in pyr[current], 0 if none */
+  int level;          /* Highest level of the pyramid in pyr[current] */
+  LKPyramid native[2]; /* Pyramids of the fixed-point kernel, used instead of pyr */
+  int useNative;      /* 1 tracks with trackLKPyramid instead of cv::calcOpticalFlowPyrLK */
+  long built;         /* Number of pyramids built, for statistics */
+  long reused;        /* Number of pyramids taken from the previous call */
+} LKCache;
 
 /***********************************************************
  * FUNCTIONS
@@ -50,10 +69,12 @@
 /**
  * Need before start of trackLK and at the end of the program for cleanup.
  */
-void initImgs();
-int trackLK(IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
+void initLKCache(LKCache *cache);
+void releaseLKCache(LKCache *cache);
+void invalidateLKCache(LKCache *cache);
+int trackLK(LKCache *cache, IplImage *imgI, IplImage *imgJ, float ptsI[], int nPtsI,
     float ptsJ[], int nPtsJ, int level, float * fbOut, float*nccOut,
-    char*statusOut);
+    char*statusOut, ScratchArena *scratch);
 
 #endif /* LK_H_ */
 
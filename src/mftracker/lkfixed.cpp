@@ -0,0 +1,507 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+/**
+ * @file lkfixed.cpp
+ *
+ * Follows the algorithm of cvCalcOpticalFlowPyrLK: images and gradients are
+ * interpolated with 14 bit weights, intensities keep 5 fractional bits.
+ * Borders are handled like there as well: images are reflected without
+ * repeating the border pixel, derivatives are 0 outside the image.
+ */
+
+/***********************************************************
+ * INCLUDES
+ ***********************************************************/
+#include "lkfixed.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/***********************************************************
+ * CONSTANT AND MACRO DEFINITIONS
+ ***********************************************************/
+
+/**
+ * Side of the tracking window and the offset of its first pixel from the
+ * point, as in cv::calcOpticalFlowPyrLK.
+ */
+#define WIN LK_WIN_SIZE
+#define HALF_WIN ((WIN - 1) * 0.5f)
+/**
+ * Side of the pixels read to interpolate a window.
+ */
+#define GRID (WIN + 1)
+/**
+ * Precision of the bilinear interpolation weights.
+ */
+#define W_BITS 14
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+/**
+ * Termination criteria, as used with cv::calcOpticalFlowPyrLK in lk.cpp.
+ */
+#define MAX_ITERATIONS 20
+#define EPSILON 0.03f
+/**
+ * Points with a smaller minimal eigenvalue of the gradient matrix
+ * are not trackable.
+ */
+#define MIN_EIG_THRESHOLD 1e-4f
+#define FLT_SCALE (1.f / (1 << 20))
+
+/***********************************************************
+ * FUNCTION
+ ***********************************************************/
+
+/**
+ * Index i mirrored into [0, n) without repeating the border pixel,
+ * as BORDER_REFLECT_101.
+ */
+static int reflect101(int i, int n)
+{
+  if (n == 1)
+  {
+    return 0;
+  }
+  while (i < 0 || i >= n)
+  {
+    i = i < 0 ? -i : 2 * n - 2 - i;
+  }
+  return i;
+}
+
+/**
+ * Sets all buffers to 0. Needed before the first buildLKPyramid.
+ */
+void initLKPyramid(LKPyramid *pyr)
+{
+  memset(pyr, 0, sizeof(LKPyramid));
+}
+
+/**
+ * Frees all buffers. The pyramid can be used again afterwards.
+ */
+void releaseLKPyramid(LKPyramid *pyr)
+{
+  int i;
+  for (i = 0; i < LK_MAX_LEVELS; i++)
+  {
+    free(pyr->level[i].img);
+    free(pyr->level[i].dx);
+    free(pyr->level[i].dy);
+  }
+  free(pyr->row);
+  initLKPyramid(pyr);
+}
+
+/**
+ * Sets the size of a level, reallocating its buffers only if they are too small.
+ */
+static void resizeLevel(LKLevel *level, int width, int height)
+{
+  level->width = width;
+  level->height = height;
+  if (width * height > level->capacity)
+  {
+    free(level->img);
+    free(level->dx);
+    free(level->dy);
+    level->capacity = width * height;
+    level->img = (unsigned char*) malloc(level->capacity);
+    level->dx = (short*) malloc(level->capacity * sizeof(short));
+    level->dy = (short*) malloc(level->capacity * sizeof(short));
+  }
+}
+
+/**
+ * Downsamples src by 2 with the 5 tap Gaussian of cvPyrDown,
+ * the borders are reflected.
+ * @param row Buffer of src->width ints.
+ */
+static void pyrDown(const LKLevel *src, LKLevel *dst, int *row)
+{
+  int sw = src->width;
+  int x, y;
+
+  for (y = 0; y < dst->height; y++)
+  {
+    const unsigned char *r0 = src->img + sw * reflect101(2 * y - 2, src->height);
+    const unsigned char *r1 = src->img + sw * reflect101(2 * y - 1, src->height);
+    const unsigned char *r2 = src->img + sw * reflect101(2 * y, src->height);
+    const unsigned char *r3 = src->img + sw * reflect101(2 * y + 1, src->height);
+    const unsigned char *r4 = src->img + sw * reflect101(2 * y + 2, src->height);
+    unsigned char *out = dst->img + dst->width * y;
+
+    //Vertical pass over the whole row
+    for (x = 0; x < sw; x++)
+    {
+      row[x] = r0[x] + 4 * (r1[x] + r3[x]) + 6 * r2[x] + r4[x];
+    }
+
+    //Horizontal pass, clamped only near the borders
+    for (x = 0; x < dst->width; x++)
+    {
+      int sx = 2 * x;
+      int sum;
+      if (sx >= 2 && sx + 2 < sw)
+      {
+        sum = row[sx - 2] + 4 * (row[sx - 1] + row[sx + 1]) + 6 * row[sx]
+            + row[sx + 2];
+      }
+      else
+      {
+        sum = row[reflect101(sx - 2, sw)] + 4 * (row[reflect101(sx - 1, sw)]
+            + row[reflect101(sx + 1, sw)]) + 6 * row[reflect101(sx, sw)]
+            + row[reflect101(sx + 2, sw)];
+      }
+      out[x] = (unsigned char) ((sum + 128) >> 8);
+    }
+  }
+}
+
+/**
+ * Scharr derivatives of a level, the borders are reflected.
+ * The inner loop has no branches, so that the compiler can vectorize it.
+ */
+static void scharr(LKLevel *level)
+{
+  int w = level->width;
+  int x, y;
+
+  for (y = 0; y < level->height; y++)
+  {
+    const unsigned char *a = level->img + w * reflect101(y - 1, level->height);
+    const unsigned char *c = level->img + w * y;
+    const unsigned char *b = level->img + w * reflect101(y + 1, level->height);
+    short *dx = level->dx + w * y;
+    short *dy = level->dy + w * y;
+
+    for (x = 1; x < w - 1; x++)
+    {
+      dx[x] = (short) (3 * (a[x + 1] - a[x - 1] + b[x + 1] - b[x - 1])
+          + 10 * (c[x + 1] - c[x - 1]));
+      dy[x] = (short) (3 * (b[x - 1] - a[x - 1] + b[x + 1] - a[x + 1])
+          + 10 * (b[x] - a[x]));
+    }
+
+    for (x = 0; x < w; x += MAX(w - 1, 1))
+    {
+      int xl = reflect101(x - 1, w);
+      int xr = reflect101(x + 1, w);
+      dx[x] = (short) (3 * (a[xr] - a[xl] + b[xr] - b[xl])
+          + 10 * (c[xr] - c[xl]));
+      dy[x] = (short) (3 * (b[xl] - a[xl] + b[xr] - a[xr])
+          + 10 * (b[x] - a[x]));
+    }
+  }
+}
+
+/**
+ * Builds the pyramid of an 8 bit single channel image with its derivatives.
+ * Levels smaller than two windows are not built, they are too coarse to help.
+ * @param pyr       Pyramid, initialized with initLKPyramid. Buffers are reused.
+ * @param img       The image.
+ * @param maxLevel  Index of the highest level, as in cvCalcOpticalFlowPyrLK.
+ * @return          Number of levels built.
+ */
+int buildLKPyramid(LKPyramid *pyr, IplImage *img, int maxLevel)
+{
+  int i;
+
+  if (img->width > pyr->rowCapacity)
+  {
+    free(pyr->row);
+    pyr->rowCapacity = img->width;
+    pyr->row = (int*) malloc(pyr->rowCapacity * sizeof(int));
+  }
+
+  resizeLevel(&pyr->level[0], img->width, img->height);
+  for (i = 0; i < img->height; i++)
+  {
+    memcpy(pyr->level[0].img + i * img->width,
+        img->imageData + i * img->widthStep, img->width);
+  }
+  scharr(&pyr->level[0]);
+  pyr->levels = 1;
+
+  for (i = 1; i <= maxLevel && i < LK_MAX_LEVELS; i++)
+  {
+    const LKLevel *src = &pyr->level[i - 1];
+    int width = (src->width + 1) / 2;
+    int height = (src->height + 1) / 2;
+
+    if (width < 2 * WIN || height < 2 * WIN)
+    {
+      break;
+    }
+
+    resizeLevel(&pyr->level[i], width, height);
+    pyrDown(src, &pyr->level[i], pyr->row);
+    scharr(&pyr->level[i]);
+    pyr->levels++;
+  }
+
+  return pyr->levels;
+}
+
+/**
+ * Bilinear weights of the fractional part of a position.
+ */
+static void interpolationWeights(float ax, float ay, int *w)
+{
+  w[0] = cvRound((1.f - ax) * (1.f - ay) * (1 << W_BITS));
+  w[1] = cvRound(ax * (1.f - ay) * (1 << W_BITS));
+  w[2] = cvRound((1.f - ax) * ay * (1 << W_BITS));
+  w[3] = (1 << W_BITS) - w[0] - w[1] - w[2];
+}
+
+/**
+ * Copies the GRID x GRID pixels at (x, y) of a level, and their derivatives
+ * if dx is not NULL. Pixels outside the level are reflected from its border,
+ * derivatives outside the level are 0.
+ */
+static void gatherWindow(const LKLevel *level, int x, int y,
+    unsigned char *img, short *dx, short *dy)
+{
+  int cols[GRID];
+  int i, j;
+
+  for (j = 0; j < GRID; j++)
+  {
+    cols[j] = reflect101(x + j, level->width);
+  }
+
+  for (i = 0; i < GRID; i++)
+  {
+    int rowInside = y + i >= 0 && y + i < level->height;
+    int row = level->width * reflect101(y + i, level->height);
+
+    for (j = 0; j < GRID; j++)
+    {
+      int inside = rowInside && x + j >= 0 && x + j < level->width;
+      img[i * GRID + j] = level->img[row + cols[j]];
+      if (dx != NULL)
+      {
+        dx[i * GRID + j] = inside ? level->dx[row + cols[j]] : 0;
+        dy[i * GRID + j] = inside ? level->dy[row + cols[j]] : 0;
+      }
+    }
+  }
+}
+
+/**
+ * Whether the pixels read to interpolate a window at (x, y) lie in the level.
+ */
+static int windowInside(const LKLevel *level, int x, int y)
+{
+  return x >= 0 && y >= 0 && x + WIN < level->width && y + WIN < level->height;
+}
+
+/**
+ * Tracks points from pyramid I to pyramid J.
+ * Windows that cross the border of a level are padded as described at the
+ * top of the file. Points whose window lies completely outside are lost.
+ * @param pyrI      Pyramid of the first image.
+ * @param pyrJ      Pyramid of the second image.
+ * @param ptsI      Points in the first image.
+ * @param ptsJ      Input: initial guesses, output: tracked points.
+ * @param nPts      Number of points.
+ * @param maxLevel  Index of the highest level used.
+ * @param status    Output: 1 if a point was tracked, 0 otherwise.
+ */
+void trackLKPyramid(const LKPyramid *pyrI, const LKPyramid *pyrJ,
+    const CvPoint2D32f *ptsI, CvPoint2D32f *ptsJ, int nPts, int maxLevel,
+    char *status)
+{
+  short ival[WIN * WIN];
+  short ixval[WIN * WIN];
+  short iyval[WIN * WIN];
+  unsigned char borderImg[GRID * GRID];
+  short borderDx[GRID * GRID];
+  short borderDy[GRID * GRID];
+  int top = MIN(maxLevel, MIN(pyrI->levels, pyrJ->levels) - 1);
+  int i, l;
+
+  for (i = 0; i < nPts; i++)
+  {
+    float nextX = 0, nextY = 0;
+    status[i] = 1;
+
+    for (l = top; l >= 0; l--)
+    {
+      const LKLevel *li = &pyrI->level[l];
+      const LKLevel *lj = &pyrJ->level[l];
+      int w = li->width;
+      float scale = 1.f / (1 << l);
+      float prevX = ptsI[i].x * scale - HALF_WIN;
+      float prevY = ptsI[i].y * scale - HALF_WIN;
+      float prevDeltaX = 0, prevDeltaY = 0;
+      float a11 = 0, a12 = 0, a22 = 0;
+      float det, minEig;
+      int iw[4];
+      int ix, iy, x, y, k, j;
+      const unsigned char *srcImg;
+      const short *srcDx, *srcDy;
+      int step;
+
+      if (l == top)
+      {
+        nextX = ptsJ[i].x * scale - HALF_WIN;
+        nextY = ptsJ[i].y * scale - HALF_WIN;
+      }
+      else
+      {
+        nextX = nextX * 2 + HALF_WIN;
+        nextY = nextY * 2 + HALF_WIN;
+      }
+
+      ix = cvFloor(prevX);
+      iy = cvFloor(prevY);
+      if (ix < -WIN || iy < -WIN || ix >= w || iy >= li->height)
+      {
+        if (l == 0)
+          status[i] = 0;
+        continue;
+      }
+
+      if (windowInside(li, ix, iy))
+      {
+        srcImg = li->img + iy * w + ix;
+        srcDx = li->dx + iy * w + ix;
+        srcDy = li->dy + iy * w + ix;
+        step = w;
+      }
+      else
+      {
+        gatherWindow(li, ix, iy, borderImg, borderDx, borderDy);
+        srcImg = borderImg;
+        srcDx = borderDx;
+        srcDy = borderDy;
+        step = GRID;
+      }
+
+      //Template window with its gradients
+      interpolationWeights(prevX - ix, prevY - iy, iw);
+      for (y = 0, k = 0; y < WIN; y++)
+      {
+        const unsigned char *src = srcImg + y * step;
+        const short *dx = srcDx + y * step;
+        const short *dy = srcDy + y * step;
+
+        for (x = 0; x < WIN; x++, k++)
+        {
+          ival[k] = (short) DESCALE(src[x] * iw[0] + src[x + 1] * iw[1]
+              + src[x + step] * iw[2] + src[x + step + 1] * iw[3], W_BITS - 5);
+          ixval[k] = (short) DESCALE(dx[x] * iw[0] + dx[x + 1] * iw[1]
+              + dx[x + step] * iw[2] + dx[x + step + 1] * iw[3], W_BITS);
+          iyval[k] = (short) DESCALE(dy[x] * iw[0] + dy[x + 1] * iw[1]
+              + dy[x + step] * iw[2] + dy[x + step + 1] * iw[3], W_BITS);
+          a11 += (float) (ixval[k] * ixval[k]);
+          a12 += (float) (ixval[k] * iyval[k]);
+          a22 += (float) (iyval[k] * iyval[k]);
+        }
+      }
+
+      a11 *= FLT_SCALE;
+      a12 *= FLT_SCALE;
+      a22 *= FLT_SCALE;
+      det = a11 * a22 - a12 * a12;
+      minEig = (a22 + a11 - sqrt((a11 - a22) * (a11 - a22) + 4.f * a12 * a12))
+          / (2 * WIN * WIN);
+
+      if (minEig < MIN_EIG_THRESHOLD || det < FLT_EPSILON)
+      {
+        if (l == 0)
+          status[i] = 0;
+        continue;
+      }
+      det = 1.f / det;
+
+      for (j = 0; j < MAX_ITERATIONS; j++)
+      {
+        float b1 = 0, b2 = 0;
+        float deltaX, deltaY;
+        int jx = cvFloor(nextX);
+        int jy = cvFloor(nextY);
+
+        if (jx < -WIN || jy < -WIN || jx >= w || jy >= lj->height)
+        {
+          if (l == 0)
+            status[i] = 0;
+          break;
+        }
+
+        if (windowInside(lj, jx, jy))
+        {
+          srcImg = lj->img + jy * w + jx;
+          step = w;
+        }
+        else
+        {
+          gatherWindow(lj, jx, jy, borderImg, NULL, NULL);
+          srcImg = borderImg;
+          step = GRID;
+        }
+
+        interpolationWeights(nextX - jx, nextY - jy, iw);
+        for (y = 0, k = 0; y < WIN; y++)
+        {
+          const unsigned char *src = srcImg + y * step;
+
+          for (x = 0; x < WIN; x++, k++)
+          {
+            int diff = DESCALE(src[x] * iw[0] + src[x + 1] * iw[1]
+                + src[x + step] * iw[2] + src[x + step + 1] * iw[3], W_BITS - 5)
+                - ival[k];
+            b1 += (float) (diff * ixval[k]);
+            b2 += (float) (diff * iyval[k]);
+          }
+        }
+
+        b1 *= FLT_SCALE;
+        b2 *= FLT_SCALE;
+        deltaX = (a12 * b2 - a22 * b1) * det;
+        deltaY = (a12 * b1 - a11 * b2) * det;
+        nextX += deltaX;
+        nextY += deltaY;
+
+        if (deltaX * deltaX + deltaY * deltaY <= EPSILON * EPSILON)
+          break;
+
+        //Oscillation between two positions, take the middle
+        if (j > 0 && fabs(deltaX + prevDeltaX) < 0.01f
+            && fabs(deltaY + prevDeltaY) < 0.01f)
+        {
+          nextX -= deltaX * 0.5f;
+          nextY -= deltaY * 0.5f;
+          break;
+        }
+        prevDeltaX = deltaX;
+        prevDeltaY = deltaY;
+      }
+    }
+
+    ptsJ[i].x = nextX + HALF_WIN;
+    ptsJ[i].y = nextY + HALF_WIN;
+  }
+}
+
+/***********************************************************
+ * END OF FILE
+ ***********************************************************/
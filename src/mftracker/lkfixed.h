@@ -0,0 +1,95 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+/**
+ * @file lkfixed.h
+ *
+ * Pyramidal Lucas-Kanade tracker with fixed-point arithmetic, made for the
+ * small workload of the median flow tracker (about 100 points, 4x4 windows).
+ */
+
+/***********************************************************
+ * PROLOGUE
+ ***********************************************************/
+
+#ifndef LKFIXED_H_
+#define LKFIXED_H_
+
+/***********************************************************
+ * INCLUDES
+ ***********************************************************/
+
+#include "opencv/cv.h"
+
+/***********************************************************
+ * CONSTANT AND MACRO DEFINITIONS
+ ***********************************************************/
+
+/**
+ * Maximum number of pyramid levels, including the image itself.
+ */
+#define LK_MAX_LEVELS 8
+/**
+ * Side of the tracking window, the winSize of cv::calcOpticalFlowPyrLK in lk.cpp.
+ */
+#define LK_WIN_SIZE 4
+
+/***********************************************************
+ * DATA DEFINITIONS
+ ***********************************************************/
+/**
+ * One pyramid level: the image and its Scharr derivatives,
+ * all stored without padding (step == width).
+ */
+typedef struct
+{
+  int width;
+  int height;
+  int capacity;       /* Allocated number of pixels, buffers only grow */
+  unsigned char *img;
+  short *dx;
+  short *dy;
+} LKLevel;
+
+/**
+ * Image pyramid with derivatives. Built once per image and used by the
+ * forward and the backward pass.
+ */
+typedef struct
+{
+  int levels;         /* Number of valid levels */
+  LKLevel level[LK_MAX_LEVELS];
+  int *row;           /* Row buffer of the downsampling, only grows */
+  int rowCapacity;
+} LKPyramid;
+
+/***********************************************************
+ * FUNCTIONS
+ ***********************************************************/
+void initLKPyramid(LKPyramid *pyr);
+void releaseLKPyramid(LKPyramid *pyr);
+int buildLKPyramid(LKPyramid *pyr, IplImage *img, int maxLevel);
+void trackLKPyramid(const LKPyramid *pyrI, const LKPyramid *pyrJ,
+    const CvPoint2D32f *ptsI, CvPoint2D32f *ptsJ, int nPts, int maxLevel,
+    char *status);
+
+#endif /* LKFIXED_H_ */
+
+/***********************************************************
+ * END OF FILE
+ ***********************************************************/
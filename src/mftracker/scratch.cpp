@@ -0,0 +1,153 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+/**
+ * @file scratch.cpp
+ */
+
+/***********************************************************
+ * INCLUDES
+ ***********************************************************/
+#include "scratch.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/***********************************************************
+ * CONSTANT AND MACRO DEFINITIONS
+ ***********************************************************/
+
+/**
+ * Alignment of all allocations, as guaranteed by malloc on 64 bit systems.
+ */
+#define SCRATCH_ALIGN 16
+
+/***********************************************************
+ * FUNCTION
+ ***********************************************************/
+
+/**
+ * Rounds size up to a multiple of SCRATCH_ALIGN.
+ */
+static size_t alignSize(size_t size)
+{
+  return (size + SCRATCH_ALIGN - 1) & ~((size_t) SCRATCH_ALIGN - 1);
+}
+
+/**
+ * malloc for the arena. The callers have no way to recover from a failed
+ * allocation, so the program is aborted.
+ */
+static void *arenaMalloc(size_t size)
+{
+  void *mem = malloc(size);
+
+  if (mem == 0)
+  {
+    fprintf(stderr, "Error: Scratch arena could not allocate %lu bytes\n",
+        (unsigned long) size);
+    abort();
+  }
+
+  return mem;
+}
+
+/**
+ * Needed before the first call of scratchAlloc.
+ */
+void initScratchArena(ScratchArena *arena)
+{
+  arena->block = 0;
+  arena->size = 0;
+  arena->used = 0;
+  arena->requested = 0;
+  arena->overflow = 0;
+  arena->numMallocs = 0;
+}
+
+/**
+ * Frees all memory. All allocations become invalid.
+ */
+void releaseScratchArena(ScratchArena *arena)
+{
+  resetScratchArena(arena);
+  free(arena->block);
+  initScratchArena(arena);
+}
+
+/**
+ * Allocates size bytes, valid until the next resetScratchArena.
+ * The memory is aligned to SCRATCH_ALIGN bytes and not initialized.
+ * @param arena The arena.
+ * @param size  Number of bytes.
+ */
+void *scratchAlloc(ScratchArena *arena, size_t size)
+{
+  char *mem;
+
+  size = alignSize(size);
+  arena->requested += size;
+
+  if (arena->used + size <= arena->size)
+  {
+    mem = arena->block + arena->used;
+    arena->used += size;
+    return mem;
+  }
+
+  //Block is full, the first SCRATCH_ALIGN bytes link the overflow blocks
+  mem = (char*) arenaMalloc(size + SCRATCH_ALIGN);
+  *(void**) mem = arena->overflow;
+  arena->overflow = mem;
+  arena->numMallocs++;
+  return mem + SCRATCH_ALIGN;
+}
+
+/**
+ * Frees all allocations. If the block was too small, it is grown to the
+ * number of bytes requested since the last reset.
+ * @return Number of heap allocations made since the last reset,
+ *         0 once the block is large enough for a frame.
+ */
+int resetScratchArena(ScratchArena *arena)
+{
+  int numMallocs = arena->numMallocs;
+
+  while (arena->overflow != 0)
+  {
+    void *next = *(void**) arena->overflow;
+    free(arena->overflow);
+    arena->overflow = next;
+  }
+
+  if (arena->requested > arena->size)
+  {
+    free(arena->block);
+    arena->size = arena->requested;
+    arena->block = (char*) arenaMalloc(arena->size);
+    numMallocs++;
+  }
+
+  arena->used = 0;
+  arena->requested = 0;
+  arena->numMallocs = 0;
+  return numMallocs;
+}
+
+/***********************************************************
+ * END OF FILE
+ ***********************************************************/
@@ -0,0 +1,70 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+/**
+ * @file scratch.h
+ *
+ * Bump allocator for the temporary buffers of one frame.
+ */
+
+/***********************************************************
+ * PROLOGUE
+ ***********************************************************/
+
+#ifndef SCRATCH_H_
+#define SCRATCH_H_
+
+/***********************************************************
+ * INCLUDES
+ ***********************************************************/
+
+#include <stddef.h>
+
+/***********************************************************
+ * DATA DEFINITIONS
+ ***********************************************************/
+/**
+ * Allocations are taken from one block and are all freed at once by
+ * resetScratchArena. If the block is full, extra blocks are allocated, and
+ * the block is grown on reset to the peak use of the frame. After the first
+ * frames no heap allocations are made any more.
+ * An arena must only be used by one thread at a time.
+ */
+typedef struct
+{
+  char *block;
+  size_t size;
+  size_t used;      /* Bytes in use in block */
+  size_t requested; /* Bytes requested since the last reset, including overflow */
+  void *overflow;   /* Blocks allocated when block was full, freed on reset */
+  int numMallocs;   /* Heap allocations since the last reset */
+} ScratchArena;
+
+/***********************************************************
+ * FUNCTIONS
+ ***********************************************************/
+void initScratchArena(ScratchArena *arena);
+void releaseScratchArena(ScratchArena *arena);
+void *scratchAlloc(ScratchArena *arena, size_t size);
+int resetScratchArena(ScratchArena *arena);
+
+#endif /* SCRATCH_H_ */
+
+/***********************************************************
+ * END OF FILE
+ ***********************************************************/
@@ -33,6 +33,7 @@ namespace tld {
         cutoff = .5;
         windows = NULL;
         numWindows = 0;
+        scratch = NULL;
     }
 
     Clustering::~Clustering() {
@@ -62,47 +63,36 @@ namespace tld {
         w /= numIndices;
         h /= numIndices;
 
-        detectionResult->detectorBB.reset(new Rect());
-        auto & rect = detectionResult->detectorBB;
-        rect->x = floor(x + 0.5);
-        rect->y = floor(y + 0.5);
-        rect->width = floor(w + 0.5);
-        rect->height = floor(h + 0.5);
+        Rect rect;
+        rect.x = floor(x + 0.5);
+        rect.y = floor(y + 0.5);
+        rect.width = floor(w + 0.5);
+        rect.height = floor(h + 0.5);
+        detectionResult->detectorBB.reset(rect);
     }
 
-    // distances must be of size n*(n+1)/2
-    void Clustering::calcDistances(vector<float>& distances) const
-    {
-        vector<int>& confidentIndices = detectionResult->confidentIndices;
+    // Finds the root of the cluster of i and compresses the path to it
+    static int findRoot(int* parents, int i) {
+        int root = i;
 
-        if (confidentIndices.empty() || distances.empty()) {
-            return;
+        while (parents[root] != root) {
+            root = parents[root];
         }
 
-        size_t const indices_size = confidentIndices.size();
-        int const firstIndex = confidentIndices[0];
-
-        for (size_t i = 0; i < indices_size; i++) {
-            confidentIndices.erase(confidentIndices.begin());
-            tldOverlapOne(windows, numWindows, firstIndex, confidentIndices, distances);
-            distances[0] += indices_size - i - 1;
+        while (parents[i] != root) {
+            int next = parents[i];
+            parents[i] = root;
+            i = next;
         }
 
-        for (size_t i = 0; i < indices_size * (indices_size - 1) / 2; i++) {
-            distances[i] = 1 - distances[i];
-        }
+        return root;
     }
 
     void Clustering::clusterConfidentIndices() {
         int const numConfidentIndices = detectionResult->confidentIndices.size();
 
-        std::vector<float> distances;
-        distances.resize(numConfidentIndices * (numConfidentIndices - 1) / 2);
-        calcDistances(distances);
-
-        std::vector<int> clusterIndices;
-        clusterIndices.resize(numConfidentIndices);
-        cluster(distances, clusterIndices);
+        int* clusterIndices = static_cast<int*>(scratchAlloc(scratch, numConfidentIndices * sizeof(int)));
+        cluster(clusterIndices);
 
         if (detectionResult->numClusters == 1) {
             calcMeanRect(detectionResult->confidentIndices);
@@ -111,105 +101,65 @@ namespace tld {
         }
     }
 
-    void Clustering::cluster(vector<float> const& distances,
-                             vector<int>& clusterIndices) {
-        int const numConfidentIndices = detectionResult->confidentIndices.size();
+    // Single linkage clustering: Two windows end up in the same cluster if they are connected
+    // by a chain of windows whose pairwise distance (1 - overlap) is below cutoff.
+    // Pairs are generated by a sweep over the windows sorted by x, as windows that do not
+    // intersect have distance 1 and can only be linked if cutoff is larger than that.
+    void Clustering::cluster(int* clusterIndices) {
+        vector<int> const& confidentIndices = detectionResult->confidentIndices;
+        int const numConfidentIndices = confidentIndices.size();
 
-        if (numConfidentIndices == 1) {
-            clusterIndices[0] = 0;
-            detectionResult->numClusters = 1;
-            return;
+        int* parents = static_cast<int*>(scratchAlloc(scratch, numConfidentIndices * sizeof(int)));
+
+        for (int i = 0; i < numConfidentIndices; i++) {
+            parents[i] = i;
         }
 
-        int const numDistances = numConfidentIndices * (numConfidentIndices - 1) / 2;
+        int numClusters = numConfidentIndices;
 
-        // Now: Cluster distances
-        std::vector<int> distUsed;
-        distUsed.resize(numDistances, 0);
+        if (cutoff > 1) {
+            // Every pair is linked
+            fill(parents, parents + numConfidentIndices, 0);
+            numClusters = min(numConfidentIndices, 1);
+        } else {
+            int* order = static_cast<int*>(scratchAlloc(scratch, numConfidentIndices * sizeof(int)));
+            copy(parents, parents + numConfidentIndices, order);
+            sort(order, order + numConfidentIndices, [&](int a, int b) {
+                return windows[TLD_WINDOW_SIZE * confidentIndices[a]] < windows[TLD_WINDOW_SIZE * confidentIndices[b]];
+            });
 
-        fill(clusterIndices.begin(), clusterIndices.end(), -1);
+            for (int i = 0; i < numConfidentIndices; i++) {
+                int* bb1 = &windows[TLD_WINDOW_SIZE * confidentIndices[order[i]]];
 
-        int newClusterIndex = 0;
+                for (int j = i + 1; j < numConfidentIndices; j++) {
+                    int* bb2 = &windows[TLD_WINDOW_SIZE * confidentIndices[order[j]]];
 
-        int numClusters = 0;
-        while (true) {
-            // Search for the shortest distance
-            float shortestDist = -1;
-            int shortestDistIndex = -1, i1, i2;
-            int distIndex = 0;
+                    if (bb2[0] > bb1[0] + bb1[2]) {
+                        break;  // All following windows start right of bb1
+                    }
 
-            for (int i = 0; i < numConfidentIndices; i++) {        // Row index
-                for (int j = i + 1; j < numConfidentIndices; j++) {  // Start from i+1
+                    int const root1 = findRoot(parents, order[i]);
+                    int const root2 = findRoot(parents, order[j]);
 
-                    if (!distUsed[distIndex] &&
-                            (shortestDistIndex == -1 || distances[distIndex] < shortestDist)) {
-                        shortestDist = distances[distIndex];
-                        shortestDistIndex = distIndex;
-                        i1 = i;
-                        i2 = j;
+                    // Windows of one cluster are not compared again, which skips most pairs around a detection
+                    if (root1 == root2) {
+                        continue;
                     }
 
-                    distIndex++;
-                }
-            }
-
-            if (shortestDistIndex == -1) {
-                break;  // We are done
-            }
+                    float const distance = 1 - tldBBOverlap(bb1, bb2);
 
-            distUsed[shortestDistIndex] = 1;
-
-            // Now: Compare the cluster indices
-            // If both have no cluster and distance is low, put them both to a new
-            // cluster
-            if (clusterIndices[i1] == -1 && clusterIndices[i2] == -1) {
-                if (shortestDist < cutoff) {
-                    // If distance is short, put them to the same cluster
-                    clusterIndices[i1] = clusterIndices[i2] = newClusterIndex;
-                    newClusterIndex++;
-                    numClusters++;
-                } else {
-                    // If distance is long, put them to different clusters
-                    clusterIndices[i1] = newClusterIndex;
-                    newClusterIndex++;
-                    numClusters++;
-                    clusterIndices[i2] = newClusterIndex;
-                    newClusterIndex++;
-                    numClusters++;
-                }
-                // Second point is  in cluster already
-            } else if (clusterIndices[i1] == -1 && clusterIndices[i2] != -1) {
-                if (shortestDist < cutoff) {
-                    clusterIndices[i1] = clusterIndices[i2];
-                } else {  // If distance is long, put them to different clusters
-                    clusterIndices[i1] = newClusterIndex;
-                    newClusterIndex++;
-                    numClusters++;
-                }
-            } else if (clusterIndices[i1] != -1 && clusterIndices[i2] == -1) {
-                if (shortestDist < cutoff) {
-                    clusterIndices[i2] = clusterIndices[i1];
-                } else {  // If distance is long, put them to different clusters
-                    clusterIndices[i2] = newClusterIndex;
-                    newClusterIndex++;
-                    numClusters++;
-                }
-            } else {  // Both indices are in clusters already
-                if (clusterIndices[i1] != clusterIndices[i2] && shortestDist < cutoff) {
-                    // Merge clusters
-                    int oldClusterIndex = clusterIndices[i2];
-
-                    for (int i = 0; i < numConfidentIndices; i++) {
-                        if (clusterIndices[i] == oldClusterIndex) {
-                            clusterIndices[i] = clusterIndices[i1];
-                        }
+                    if (distance < cutoff) {
+                        parents[root2] = root1;
+                        numClusters--;
                     }
-
-                    numClusters--;
                 }
             }
         }
 
+        for (int i = 0; i < numConfidentIndices; i++) {
+            clusterIndices[i] = findRoot(parents, i);
+        }
+
         detectionResult->numClusters = numClusters;
     }
 
@@ -31,6 +31,7 @@
 #include <opencv/cv.h>
 
 #include "DetectionResult.h"
+#include "scratch.h"
 
 using namespace std;
 using namespace cv;
@@ -42,15 +43,14 @@ namespace tld
     {
             void calcMeanRect(vector<int> const &indices);
 
-            void calcDistances(vector<float> &distances) const;
-
-            void cluster(vector<float> const & distances, vector<int> & clusterIndices);
+            void cluster(int * clusterIndices);
 
         public:
             int* windows;
             int numWindows;
 
             std::shared_ptr<DetectionResult> detectionResult;
+            ScratchArena * scratch; //Arena of the detector, for the working buffers
 
             //Configurable members
             float cutoff;
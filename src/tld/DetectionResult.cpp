@@ -41,6 +41,7 @@ void DetectionResult::init(int numWindows, int numTrees) {
     variances.resize(numWindows);
     posteriors.resize(numWindows);
     featureVectors.resize(numWindows*numTrees);
+    confidentIndices.reserve(numWindows); //Any window may be confident, so the scans do not grow it
 }
 
 void DetectionResult::reset() {
@@ -48,6 +49,8 @@ void DetectionResult::reset() {
 	fgList.clear();
 	confidentIndices.clear();
 	numClusters = 0;
+	detectorBB.reset();
+	scanRegion.reset();
 }
 
 void DetectionResult::release() {
@@ -27,9 +27,10 @@
 #define DETECTIONRESULT_H_
 
 #include <vector>
-#include <memory>
 #include <opencv/cv.h>
 
+#include "OptionalRect.h"
+
 using namespace std;
 using namespace cv;
 
@@ -57,7 +58,8 @@ namespace tld {
             vector<float> posteriors;
             vector<int>   featureVectors;
 
-            shared_ptr<Rect> detectorBB; //Contains a valid result only if numClusters = 1
+            OptionalRect detectorBB; //Contains a valid result only if numClusters = 1
+            OptionalRect scanRegion; //Set if only the windows inside this region were evaluated, see DetectorCascade::detectLocal()
 
             bool containsValidData;
     };
@@ -26,6 +26,7 @@
 #include "DetectorCascade.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include "TLDUtil.h"
 
@@ -52,10 +53,19 @@ DetectorCascade::DetectorCascade() {
 
 	initialised = false;
 
+	numWindows = 0;
+	numScales = 0;
+	scales = NULL;
+	grids = NULL;
+	windows = NULL;
+	windowOffsets = NULL;
+	windowsCapacity = 0;
+	initScratchArena(&scratch);
+
     foregroundDetector.reset( new ForegroundDetector() );
     varianceFilter.reset( new VarianceFilter() );
     ensembleClassifier.reset( new EnsembleClassifier( *this ) );
-    nnClassifier.reset( new NNClassifier() );
+    nnClassifier.reset( NNClassifier::create(TLD_PATCH_SIZE) );
     clustering.reset( new Clustering() );
     detectionResult.reset( new DetectionResult() );
 }
@@ -63,6 +73,8 @@ DetectorCascade::DetectorCascade() {
 DetectorCascade::~DetectorCascade()
 {
 	release();
+	freeBuffers();
+	releaseScratchArena(&scratch);
 }
 
 void DetectorCascade::init()
@@ -95,6 +107,26 @@ void DetectorCascade::propagateMembers() {
 	varianceFilter->detectionResult = detectionResult;
 	nnClassifier->detectionResult = detectionResult;
     clustering->detectionResult = detectionResult;
+    clustering->scratch = &scratch;
+}
+
+//Replaces the NN classifier by one working on patches of the given size.
+//Settings are kept, learned samples are discarded. Returns false if the size is not supported.
+bool DetectorCascade::setPatchSize(int patchSize) {
+	if(patchSize == nnClassifier->patchSize()) {
+		return true;
+	}
+
+	NNClassifier * nn = NNClassifier::create(patchSize);
+
+	if(nn == NULL) {
+		return false;
+	}
+
+	nn->copySettings(*nnClassifier);
+	nnClassifier.reset(nn);
+
+	return true;
 }
 
 void DetectorCascade::release() {
@@ -113,10 +145,6 @@ void DetectorCascade::release() {
 	numWindows = 0;
 	numScales = 0;
 
-	delete[] scales;
-	delete[] windows;
-	delete[] windowOffsets;
-
 	objWidth = -1;
 	objHeight = -1;
 
@@ -139,9 +167,10 @@ void DetectorCascade::initWindowsAndScales() {
 	int scanAreaW = imgWidth-1;
 	int scanAreaH = imgHeight-1;
 
-	int windowIndex = 0;
-
+	delete[] scales;
+	delete[] grids;
     scales = new Size[maxScale-minScale+1];
+    grids = new WindowGrid[maxScale-minScale+1];
 
 	numWindows = 0;
 
@@ -164,56 +193,173 @@ void DetectorCascade::initWindowsAndScales() {
 		scales[scaleIndex].width = w;
 		scales[scaleIndex].height = h;
 
+		WindowGrid & grid = grids[scaleIndex];
+		grid.firstWindow = numWindows;
+		grid.x = scanAreaX;
+		grid.y = scanAreaY;
+		grid.stepX = ssw;
+		grid.stepY = ssh;
+		grid.cols = (scanAreaW - w) / ssw + 1;
+		grid.rows = (scanAreaH - h) / ssh + 1;
+
 		scaleIndex++;
 
-		numWindows += floor((float)(scanAreaW - w + ssw)/ssw)*floor((float)(scanAreaH - h + ssh) / ssh);
+		numWindows += grid.cols * grid.rows;
 	}
 
 	numScales = scaleIndex;
 
-	windows = new int[TLD_WINDOW_SIZE*numWindows];
+	//The buffers are kept across release(), so reselecting an object does not allocate
+	if(numWindows > windowsCapacity) {
+		delete[] windows;
+		delete[] windowOffsets;
+		windows = new int[TLD_WINDOW_SIZE*numWindows];
+		windowOffsets = new int[TLD_WINDOW_OFFSET_SIZE*numWindows];
+		windowsCapacity = numWindows;
+		windowsLayout.clear();
+		windowOffsetsLayout.clear();
+	}
+
+	vector<float> layout;
+	getWindowLayout(layout);
+
+	if(layout == windowsLayout) {
+		return; //Same windows as before
+	}
 
+	#pragma omp parallel for schedule(dynamic)
 	for(scaleIndex = 0; scaleIndex < numScales; scaleIndex++) {
-		int w = scales[scaleIndex].width;
-		int h = scales[scaleIndex].height;
+		int const w = scales[scaleIndex].width;
+		int const h = scales[scaleIndex].height;
+		WindowGrid const & grid = grids[scaleIndex];
 
-		int ssw,ssh;
-		if(useShift) {
-			ssw = max<float>(1,w*shift);
-			ssh = max<float>(1,h*shift);
-		} else {
-			ssw = 1;
-			ssh = 1;
-		}
+		int * bb = &windows[TLD_WINDOW_SIZE*grid.firstWindow];
 
-		for(int y = scanAreaY; y + h <= scanAreaY +scanAreaH; y+=ssh) {
-			for(int x = scanAreaX; x + w <= scanAreaX + scanAreaW; x+=ssw) {
-				int * bb = &windows[TLD_WINDOW_SIZE*windowIndex];
-				tldCopyBoundaryToArray<int>(x,y,w,h, bb);
-				bb[4] = scaleIndex;
+		for(int row = 0; row < grid.rows; row++) {
+			int const y = grid.y + row * grid.stepY;
 
-				windowIndex++;
+			for(int col = 0; col < grid.cols; col++) {
+				bb[0] = grid.x + col * grid.stepX;
+				bb[1] = y;
+				bb[2] = w;
+				bb[3] = h;
+				bb[4] = scaleIndex;
+				bb += TLD_WINDOW_SIZE;
 			}
 		}
+	}
+
+	windowsLayout.swap(layout);
+}
+
+//Everything the windows and their offsets depend on
+void DetectorCascade::getWindowLayout(vector<float> & layout) const {
+	layout.clear();
+	layout.push_back(imgWidth);
+	layout.push_back(imgHeight);
+	layout.push_back(imgWidthStep);
+	layout.push_back(objWidth);
+	layout.push_back(objHeight);
+	layout.push_back(minScale);
+	layout.push_back(maxScale);
+	layout.push_back(useShift);
+	layout.push_back(shift);
+	layout.push_back(minSize);
+	layout.push_back(numTrees);
+	layout.push_back(numFeatures);
+}
+
+void DetectorCascade::freeBuffers() {
+	delete[] scales;
+	delete[] grids;
+	delete[] windows;
+	delete[] windowOffsets;
+
+	scales = NULL;
+	grids = NULL;
+	windows = NULL;
+	windowOffsets = NULL;
+	windowsCapacity = 0;
+
+	windowsLayout.clear();
+	windowOffsetsLayout.clear();
+}
+
+//Returns all windows with an overlap larger than minOverlap with bb, in the order of their index.
+//Instead of testing every window, the range of grid positions that can reach minOverlap is computed for each scale.
+void DetectorCascade::findOverlappingWindows(Rect const & bb, float minOverlap, vector<pair<int,float> > & indices) const {
+	int box[4];
+	tldRectToArray<int>(bb, box);
+
+	float const boxArea = bb.width * bb.height;
+
+	for(int scaleIndex = 0; scaleIndex < numScales; scaleIndex++) {
+		int const w = scales[scaleIndex].width;
+		int const h = scales[scaleIndex].height;
+		WindowGrid const & grid = grids[scaleIndex];
+
+		//overlap > minOverlap requires intersection > minOverlap*(area1+area2)/(1+minOverlap),
+		//which bounds the width and the height of the intersection
+		float const minIntersection = minOverlap * (w*h + boxArea) / (1 + minOverlap);
+		int const minCols = max(1, (int) floor(minIntersection / min(h, bb.height)));
+		int const minRows = max(1, (int) floor(minIntersection / min(w, bb.width)));
+
+		if(minCols > min(w, bb.width) || minRows > min(h, bb.height)) continue;
 
+		//Grid positions with an intersection of at least minCols x minRows
+		int const colStart = max(0, (int) ceil((float) (bb.x + minCols - w - grid.x) / grid.stepX));
+		int const colEnd = min(grid.cols - 1, (int) floor((float) (bb.x + bb.width - minCols - grid.x) / grid.stepX));
+		int const rowStart = max(0, (int) ceil((float) (bb.y + minRows - h - grid.y) / grid.stepY));
+		int const rowEnd = min(grid.rows - 1, (int) floor((float) (bb.y + bb.height - minRows - grid.y) / grid.stepY));
+
+		for(int row = rowStart; row <= rowEnd; row++) {
+			for(int col = colStart; col <= colEnd; col++) {
+				int const idx = grid.firstWindow + row * grid.cols + col;
+				float const overlap = tldBBOverlap(&windows[TLD_WINDOW_SIZE*idx], box);
+
+				if(overlap > minOverlap) {
+					indices.push_back(pair<int,float>(idx, overlap));
+				}
+			}
+		}
 	}
+}
 
-	assert(windowIndex == numWindows);
+//Returns all windows with scores[i] > minScore and an overlap smaller than maxOverlap with bb.
+//The overlap is only computed for windows that pass the score test.
+void DetectorCascade::findNegativeWindows(Rect const & bb, float maxOverlap, vector<float> const & scores, float minScore, vector<int> & indices) const {
+	int box[4];
+	tldRectToArray<int>(bb, box);
+
+	for(int i = 0; i < numWindows; i++) {
+		if(scores[i] <= minScore) continue;
+
+		if(tldBBOverlap(&windows[TLD_WINDOW_SIZE*i], box) < maxOverlap) {
+			indices.push_back(i);
+		}
+	}
 }
 
 //Creates offsets that can be added to bounding boxes
 //offsets are contained in the form delta11, delta12,... (combined index of dw and dh)
 //Order: scale->tree->feature
+//The buffer is allocated by initWindowsAndScales()
 void DetectorCascade::initWindowOffsets() {
 
-	windowOffsets = new int[TLD_WINDOW_OFFSET_SIZE*numWindows];
-	int *off = windowOffsets;
+	vector<float> layout;
+	getWindowLayout(layout);
+
+	if(layout == windowOffsetsLayout) {
+		return; //Same offsets as before
+	}
 
 	int windowSize = TLD_WINDOW_SIZE;
 
+	#pragma omp parallel for
 	for (int i = 0; i < numWindows; i++) {
 
 		int *window = windows+windowSize*i;
+		int *off = windowOffsets+TLD_WINDOW_OFFSET_SIZE*i;
 		*off++ = sub2idx(window[0]-1,window[1]-1,imgWidthStep); // x1-1,y1-1
 		*off++ = sub2idx(window[0]-1,window[1]+window[3]-1,imgWidthStep); // x1-1,y2
 		*off++ = sub2idx(window[0]+window[2]-1,window[1]-1,imgWidthStep); // x2,y1-1
@@ -221,24 +367,85 @@ void DetectorCascade::initWindowOffsets() {
 		*off++ = window[4]*2*numFeatures*numTrees; // pointer to features for this scale
 		*off++ = window[2]*window[3];//Area of bounding box
 	}
+
+	windowOffsetsLayout.swap(layout);
 }
 
-void DetectorCascade::detect(Mat img) {
-	//For every bounding box, the output is confidence, pattern, variance
+//Stores the indices of all windows that lie completely inside region and returns their number.
+//indices must have room for numWindows entries.
+int DetectorCascade::findWindowsInside(Rect const & region, int * indices) const {
+	int numIndices = 0;
+
+	for(int scaleIndex = 0; scaleIndex < numScales; scaleIndex++) {
+		int const w = scales[scaleIndex].width;
+		int const h = scales[scaleIndex].height;
+		WindowGrid const & grid = grids[scaleIndex];
+
+		int const colStart = max(0, (int) ceil((float) (region.x - grid.x) / grid.stepX));
+		int const colEnd = min(grid.cols - 1, (int) floor((float) (region.x + region.width - w - grid.x) / grid.stepX));
+		int const rowStart = max(0, (int) ceil((float) (region.y - grid.y) / grid.stepY));
+		int const rowEnd = min(grid.rows - 1, (int) floor((float) (region.y + region.height - h - grid.y) / grid.stepY));
+
+		for(int row = rowStart; row <= rowEnd; row++) {
+			for(int col = colStart; col <= colEnd; col++) {
+				indices[numIndices++] = grid.firstWindow + row * grid.cols + col;
+			}
+		}
+	}
+
+	return numIndices;
+}
+
+void DetectorCascade::detect(Mat const & img) {
+	detectionResult->reset();
+
+	if(!initialised) {
+		return;
+	}
+
+	scanWindows(img, NULL, numWindows);
+}
 
+//Only evaluates the windows inside region, e.g. to verify the tracker between two full scans.
+//All other windows get a posterior of 0, the region is stored in the detection result.
+void DetectorCascade::detectLocal(Mat const & img, Rect const & region) {
 	detectionResult->reset();
 
 	if(!initialised) {
 		return;
 	}
 
+	int * indices = static_cast<int*>(scratchAlloc(&scratch, numWindows * sizeof(int)));
+	int const numIndices = findWindowsInside(region, indices);
+
+	fill(detectionResult->posteriors.begin(), detectionResult->posteriors.end(), 0.f);
+
+	scanWindows(img, indices, numIndices);
+	detectionResult->scanRegion.reset(region);
+}
+
+//Runs the cascade on the given windows, or on all windows if indices is NULL
+void DetectorCascade::scanWindows(Mat const & img, int const * indices, int numIndices) {
+	//For every bounding box, the output is confidence, pattern, variance
+
 	//Prepare components
 	foregroundDetector->nextIteration(img); //Calculates foreground
 	varianceFilter->nextIteration(img); //Calculates integral images
 	ensembleClassifier->nextIteration(img);
 
+	//Windows are flagged in parallel and collected afterwards, in order
+	char * confident = static_cast<char*>(scratchAlloc(&scratch, numWindows));
+
+	if(indices) {
+		memset(confident, 0, numWindows);
+	}
+
 	#pragma omp parallel for
-	for (int i = 0; i < numWindows; i++) {
+	for (int k = 0; k < numIndices; k++) {
+
+		int const i = indices ? indices[k] : k;
+
+		confident[i] = 0;
 
 		int * window = &windows[TLD_WINDOW_SIZE*i];
 
@@ -273,10 +480,15 @@ void DetectorCascade::detect(Mat img) {
 			continue;
 		}
 
-		detectionResult->confidentIndices.push_back(i);
-
+		confident[i] = 1;
+	}
 
+	for (int i = 0; i < numWindows; i++) {
+		if(confident[i]) {
+			detectionResult->confidentIndices.push_back(i);
+		}
 	}
+
 	//Cluster
 	clustering->clusterConfidentIndices();
 
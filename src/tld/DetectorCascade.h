@@ -32,6 +32,7 @@
 #include "EnsembleClassifier.h"
 #include "Clustering.h"
 #include "NNClassifier.h"
+#include "scratch.h"
 
 
 
@@ -41,6 +42,17 @@ namespace tld {
     static const int TLD_WINDOW_SIZE = 5;
     static const int TLD_WINDOW_OFFSET_SIZE = 6;
 
+    //Layout of the sliding windows of one scale, they form a regular grid
+    struct WindowGrid {
+        int firstWindow;
+        int x;
+        int y;
+        int stepX;
+        int stepY;
+        int cols;
+        int rows;
+    };
+
     class DetectorCascade {
 
             friend class EnsembleClassifier;
@@ -48,6 +60,16 @@ namespace tld {
             //Working data
             int numScales;
             Size* scales;
+            WindowGrid* grids;
+
+            //Allocated size of windows and windowOffsets, and the parameters they were last computed for
+            int windowsCapacity;
+            vector<float> windowsLayout;
+            vector<float> windowOffsetsLayout;
+
+            void getWindowLayout(vector<float> & layout) const;
+            void freeBuffers();
+            void scanWindows(Mat const & img, int const * indices, int numIndices);
         public:
             //Configurable members
             int minScale;
@@ -80,6 +102,8 @@ namespace tld {
             std::shared_ptr<NNClassifier> nnClassifier;
             std::shared_ptr<DetectionResult> detectionResult;
 
+            ScratchArena scratch; //Working buffers of detect(), reset by the owner after every frame
+
             void propagateMembers();
 
             DetectorCascade();
@@ -90,9 +114,16 @@ namespace tld {
             void initWindowOffsets();
             void initWindowsAndScales();
 
+            bool setPatchSize(int patchSize);
+
+            void findOverlappingWindows(Rect const & bb, float minOverlap, vector<pair<int,float> > & indices) const;
+            int findWindowsInside(Rect const & region, int * indices) const;
+            void findNegativeWindows(Rect const & bb, float maxOverlap, vector<float> const & scores, float minScore, vector<int> & indices) const;
+
             void release();
             void cleanPreviousData();
-            void detect(Mat img);
+            void detect(Mat const & img);
+            void detectLocal(Mat const & img, Rect const & region);
             void drawDetection(IplImage * img) const;
     };
 
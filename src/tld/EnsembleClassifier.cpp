@@ -24,6 +24,7 @@
  */
 
 #include <cstdlib>
+#include <cstring>
 #include <math.h>
 #include <opencv/cv.h>
 
@@ -45,10 +46,23 @@ namespace tld {
         dtc.numTrees = 10;
         dtc.numFeatures = 8;
         enabled = true;
+
+        features = NULL;
+        featureOffsets = NULL;
+        posteriors = NULL;
+        positives = NULL;
+        negatives = NULL;
+        backPosteriors = NULL;
+        backPositives = NULL;
+        backNegatives = NULL;
+        featuresCapacity = 0;
+        featureOffsetsCapacity = 0;
+        posteriorsCapacity = 0;
     }
 
     EnsembleClassifier::~EnsembleClassifier() {
         release();
+        freeBuffers();
     }
 
     void EnsembleClassifier::init() {
@@ -59,7 +73,16 @@ namespace tld {
         initPosteriors();
     }
 
+    void EnsembleClassifier::setSeed(int seed) {
+        rng = RNG(seed);
+    }
+
+    //The buffers are kept, so reselecting an object of the same kind does not allocate.
+    //init() overwrites all of them.
     void EnsembleClassifier::release() {
+    }
+
+    void EnsembleClassifier::freeBuffers() {
         delete[] features;
         features = NULL;
         delete[] featureOffsets;
@@ -70,6 +93,26 @@ namespace tld {
         positives = NULL;
         delete[] negatives;
         negatives = NULL;
+        delete[] backPosteriors;
+        backPosteriors = NULL;
+        delete[] backPositives;
+        backPositives = NULL;
+        delete[] backNegatives;
+        backNegatives = NULL;
+        featuresCapacity = 0;
+        featureOffsetsCapacity = 0;
+        posteriorsCapacity = 0;
+    }
+
+    //Makes room for the measurements of numTrees * numFeatures features
+    void EnsembleClassifier::allocateFeatures() {
+        int size = 2 * 2 * dtc.numFeatures * dtc.numTrees;
+
+        if(size > featuresCapacity) {
+            delete[] features;
+            features = new float[size];
+            featuresCapacity = size;
+        }
     }
 
     /*
@@ -78,10 +121,10 @@ namespace tld {
     void EnsembleClassifier::initFeatureLocations() {
         int size = 2 * 2 * dtc.numFeatures * dtc.numTrees;
 
-        features = new float[size];
+        allocateFeatures();
 
         for(int i=0; i < size; i++) {
-            features[i] = rand() / (float)RAND_MAX;
+            features[i] = rng.uniform(0.f, 1.f);
         }
 
     }
@@ -89,16 +132,23 @@ namespace tld {
     //Creates offsets that can be added to bounding boxes
     //offsets are contained in the form delta11, delta12,... (combined index of dw and dh)
     //Order: scale.tree->feature
+    //The scales are independent and computed in parallel
     void EnsembleClassifier::initFeatureOffsets() {
 
-        featureOffsets= new int[dtc.numScales * dtc.numTrees
-                 * dtc.numFeatures * 2];
+        int const scaleSize = dtc.numTrees * dtc.numFeatures * 2;
+        int const size = dtc.numScales * scaleSize;
 
-        int *off = featureOffsets;
+        if(size > featureOffsetsCapacity) {
+            delete[] featureOffsets;
+            featureOffsets = new int[size];
+            featureOffsetsCapacity = size;
+        }
 
+        #pragma omp parallel for
         for (int k = 0; k < dtc.numScales; k++)
         {
             Size scale = dtc.scales[k];
+            int *off = featureOffsets + k * scaleSize;
 
             for (int i = 0; i < dtc.numTrees; i++)
             {
@@ -112,23 +162,31 @@ namespace tld {
         }
     }
 
+    //Clears the posteriors, the arrays are only reallocated if they are too small
     void EnsembleClassifier::initPosteriors()
     {
-        //TODO: Ben - refactor this crap
-
-        posteriors = new float[dtc.numTrees * numIndices];
-        positives = new int[dtc.numTrees * numIndices];
-        negatives = new int[dtc.numTrees * numIndices];
-
-        for (int i = 0; i < dtc.numTrees; i++)
-        {
-            for(int j = 0; j < numIndices; j++)
-            {
-                posteriors[i*numIndices + j] = 0;
-                positives[i*numIndices + j] = 0;
-                negatives[i*numIndices + j] = 0;
-            }
+        int const size = dtc.numTrees * numIndices;
+
+        if(size > posteriorsCapacity) {
+            delete[] posteriors;
+            delete[] positives;
+            delete[] negatives;
+            delete[] backPosteriors;
+            delete[] backPositives;
+            delete[] backNegatives;
+
+            posteriors = new float[size];
+            positives = new int[size];
+            negatives = new int[size];
+            backPosteriors = NULL; //Allocated by prepareBackBuffer()
+            backPositives = NULL;
+            backNegatives = NULL;
+            posteriorsCapacity = size;
         }
+
+        memset(posteriors, 0, size * sizeof(float));
+        memset(positives, 0, size * sizeof(int));
+        memset(negatives, 0, size * sizeof(int));
     }
 
     void EnsembleClassifier::nextIteration(Mat img) {
@@ -139,6 +197,11 @@ namespace tld {
 
     //Classical fern algorithm
     int EnsembleClassifier::calcFernFeature(int windowIdx, int treeIdx) {
+        return calcFernFeature(img, windowIdx, treeIdx);
+    }
+
+    //image must have the same layout as the frames passed to nextIteration()
+    int EnsembleClassifier::calcFernFeature(unsigned char const * image, int windowIdx, int treeIdx) const {
 
         int index = 0;
         int *bbox = dtc.windowOffsets+ windowIdx* TLD_WINDOW_OFFSET_SIZE;
@@ -146,8 +209,8 @@ namespace tld {
         for (int i=0; i<dtc.numFeatures; i++) {
             index<<=1;
 
-            int fp0 = img[bbox[0] + off[0]];
-            int fp1 = img[bbox[0] + off[1]];
+            int fp0 = image[bbox[0] + off[0]];
+            int fp1 = image[bbox[0] + off[1]];
             if (fp0>fp1) { index |= 1;}
             off += 2;
         }
@@ -155,24 +218,34 @@ namespace tld {
     }
 
     void EnsembleClassifier::calcFeatureVector(int windowIdx, int * featureVector)
+    {
+        calcFeatureVector(img, windowIdx, featureVector);
+    }
+
+    void EnsembleClassifier::calcFeatureVector(unsigned char const * image, int windowIdx, int * featureVector) const
     {
         for(int i = 0; i < dtc.numTrees; i++) {
-            featureVector[i] = calcFernFeature(windowIdx, i);
+            featureVector[i] = calcFernFeature(image, windowIdx, i);
         }
     }
 
     float EnsembleClassifier::calcConfidence(int * featureVector)
+    {
+        return calcConfidence(featureVector, posteriors);
+    }
+
+    float EnsembleClassifier::calcConfidence(int * featureVector, float const * post) const
     {
         float conf = 0.0;
 
-        if (!posteriors)
+        if (!post)
         {
             return -1.f;
         }
 
         for(int i = 0; i < dtc.numTrees; i++)
         {
-            conf += posteriors[i * numIndices + featureVector[i]];
+            conf += post[i * numIndices + featureVector[i]];
         }
 
         return conf;
@@ -201,9 +274,14 @@ namespace tld {
     }
 
     void EnsembleClassifier::updatePosterior(int treeIdx, int idx, int positive, int amount) {
+        updatePosterior(treeIdx, idx, positive, amount, posteriors, positives, negatives);
+    }
+
+    //Updates the given arrays, which are either the ones of the detector or the back buffer
+    void EnsembleClassifier::updatePosterior(int treeIdx, int idx, int positive, int amount, float * post, int * pos, int * neg) {
         int arrayIndex = treeIdx * numIndices + idx;
-        (positive) ? positives[arrayIndex] += amount : negatives[arrayIndex] += amount;
-        posteriors[arrayIndex] = ((float) positives[arrayIndex]) / (positives[arrayIndex] + negatives[arrayIndex]) ;// / 10.0;
+        (positive) ? pos[arrayIndex] += amount : neg[arrayIndex] += amount;
+        post[arrayIndex] = ((float) pos[arrayIndex]) / (pos[arrayIndex] + neg[arrayIndex]) ;// / 10.0;
     }
 
     void EnsembleClassifier::updatePosteriors(int *featureVector, int positive, int amount) {
@@ -217,17 +295,49 @@ namespace tld {
     }
 
     void EnsembleClassifier::learn(int positive, int * featureVector) {
+        learn(positive, featureVector, posteriors, positives, negatives);
+    }
+
+    void EnsembleClassifier::learn(int positive, int * featureVector, float * post, int * pos, int * neg) {
         if(!enabled) return;
 
-        float conf = calcConfidence(featureVector);
+        float conf = calcConfidence(featureVector, post);
 
         //Update if positive patch and confidence < 0.5 or negative and conf > 0.5
         if((positive && conf < 0.5) || (!positive && conf > 0.5)) {
-            updatePosteriors(featureVector, positive,1);
+            for (int i = 0; i < dtc.numTrees; i++) {
+                updatePosterior(i, featureVector[i], positive, 1, post, pos, neg);
+            }
         }
 
     }
 
+    //Brings the back buffer up to date with the posteriors used by the detector
+    void EnsembleClassifier::prepareBackBuffer() {
+        int const size = dtc.numTrees * numIndices;
+
+        if(backPosteriors == NULL) {
+            backPosteriors = new float[posteriorsCapacity];
+            backPositives = new int[posteriorsCapacity];
+            backNegatives = new int[posteriorsCapacity];
+        }
+
+        memcpy(backPosteriors, posteriors, size * sizeof(float));
+        memcpy(backPositives, positives, size * sizeof(int));
+        memcpy(backNegatives, negatives, size * sizeof(int));
+    }
+
+    void EnsembleClassifier::learnBackBuffer(int positive, int * featureVector) {
+        learn(positive, featureVector, backPosteriors, backPositives, backNegatives);
+    }
+
+    //Makes the back buffer visible to the detector. Must not be called while the detector is running.
+    void EnsembleClassifier::swapBackBuffer() {
+        swap(posteriors, backPosteriors);
+        swap(positives, backPositives);
+        swap(negatives, backNegatives);
+    }
+
 
 
 } /* namespace tld */
@@ -44,6 +44,7 @@ namespace tld {
             EnsembleClassifier( DetectorCascade & dc);
             virtual ~EnsembleClassifier();
             void init();
+            void setSeed(int seed);
             void initFeatureLocations();
             void initFeatureOffsets();
             void initPosteriors();
@@ -54,11 +55,25 @@ namespace tld {
             void learn(int positive, int * featureVector);
             bool filter(int i);
 
+            //Double buffering for the background learner, see TLD::learningLoop()
+            void prepareBackBuffer();
+            void learnBackBuffer(int positive, int * featureVector);
+            void swapBackBuffer();
+
             float calcConfidence(int * featureVector);
             int calcFernFeature(int windowIdx, int treeIdx);
+            int calcFernFeature(unsigned char const * image, int windowIdx, int treeIdx) const;
             void calcFeatureVector(int windowIdx, int * featureVector);
+            void calcFeatureVector(unsigned char const * image, int windowIdx, int * featureVector) const;
             void updatePosteriors(int *featureVector, int positive, int amount);
 
+        private:
+            float calcConfidence(int * featureVector, float const * post) const;
+            void learn(int positive, int * featureVector, float * post, int * pos, int * neg);
+            void updatePosterior(int treeIdx, int idx, int positive, int amount, float * post, int * pos, int * neg);
+            void allocateFeatures();
+            void freeBuffers();
+
         public:
             bool enabled;
 
@@ -72,8 +87,20 @@ namespace tld {
             int * positives;
             int * negatives;
 
+            //Copy of the posteriors that is updated by the background learner while the detector reads the ones above
+            float * backPosteriors;
+            int * backPositives;
+            int * backNegatives;
+
+            //Allocated sizes, the buffers are kept across release() and only grow
+            int featuresCapacity;
+            int featureOffsetsCapacity;
+            int posteriorsCapacity;
+
             DetectorCascade & dtc;
             unsigned char* img;
+
+            RNG rng; //Per instance, so that several trackers can be initialised concurrently
     };
 
 } /* namespace tld */
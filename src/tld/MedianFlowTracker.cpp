@@ -32,12 +32,23 @@ namespace tld
 
 MedianFlowTracker::MedianFlowTracker()
 {
-    trackerBB = NULL;
+    fbError = 0;
+    maxPoints = 0;
+    objectSize = 0;
+    nativeLK = false;
+    motionModel = false;
+    cropScale = 1;
+    currentCrop = 0;
+    initLKCache(&lkCache);
+    initScratchArena(&scratch);
+    resetMotion();
 }
 
 MedianFlowTracker::~MedianFlowTracker()
 {
     cleanPreviousData();
+    releaseLKCache(&lkCache);
+    releaseScratchArena(&scratch);
 }
 
 void MedianFlowTracker::cleanPreviousData()
@@ -45,20 +56,172 @@ void MedianFlowTracker::cleanPreviousData()
     trackerBB.reset();
 }
 
-void MedianFlowTracker::track(Mat prevMat, Mat currMat, Rect &prevBB)
+void MedianFlowTracker::resetMotion()
+{
+    hasMotion = false;
+    velocity[0] = velocity[1] = 0;
+    motionError = 0;
+}
+
+//Highest pyramid level needed to find a point that is residual pixels away from its initial guess.
+//LK roughly converges within half a window per level, LK_WIN_SIZE / 2 * (2^(level+1) - 1) pixels.
+static int levelForMotion(float residual)
+{
+    int level = 0;
+
+    while(level < 5 && LK_WIN_SIZE / 2 * ((2 << level) - 1) < residual)
+    {
+        level++;
+    }
+
+    return level;
+}
+
+//Crop of frame scaled by scale, written to buffer if it has to be resized and a view of frame otherwise.
+//The buffer only grows, the crop is a view of it, so that crops of changing size do not reallocate it.
+static void cropFrame(Mat frame, Rect roi, float scale, Mat &buffer, Mat &crop)
+{
+    if(scale < 1)
+    {
+        //Size that resize() derives from the scale
+        Size size(cvRound(roi.width * static_cast<double>(scale)), cvRound(roi.height * static_cast<double>(scale)));
+
+        if(buffer.rows < size.height || buffer.cols < size.width)
+        {
+            buffer.create(max(buffer.rows, size.height), max(buffer.cols, size.width), CV_8UC1);
+        }
+
+        crop = buffer(Rect(Point(), size));
+        resize(frame(roi), crop, Size(), scale, scale, INTER_AREA);
+    }
+    else
+    {
+        crop = frame(roi);
+    }
+}
+
+void MedianFlowTracker::track(Mat prevMat, Mat currMat, Rect const &prevBB)
 {
     if (prevBB.width <= 0 || prevBB.height <= 0)
     {
         return;
     }
 
+    if(lkCache.useNative != nativeLK)
+    {
+        //The cached pyramid belongs to the other kernel
+        invalidateLKCache(&lkCache);
+        lkCache.useNative = nativeLK;
+    }
+
     float bb_tracker[] = {static_cast<float>(prevBB.x), static_cast<float>(prevBB.y), static_cast<float>(prevBB.width + prevBB.x - 1), static_cast<float>(prevBB.height + prevBB.y - 1)};
     float scale;
+    float prevCenterX = (bb_tracker[0] + bb_tracker[2]) / 2;
+    float prevCenterY = (bb_tracker[1] + bb_tracker[3]) / 2;
+
+    //Constant velocity prediction. The pyramid only needs the levels to cover the expected error of the prediction.
+    float motion[2] = {0, 0};
+    int level = 5;
+
+    if(motionModel && hasMotion)
+    {
+        motion[0] = velocity[0];
+        motion[1] = velocity[1];
+        level = levelForMotion(2 * motionError + 2);
+    }
+
+    //Crop the box padded by its larger side, and shrink the crop so that the object has at most objectSize pixels
+    Rect frame(0, 0, currMat.cols, currMat.rows);
+    Rect roi = frame;
+    Rect covered = frame; //Part of the frame a reused crop must contain
+    float roiScale = 1;
+
+    if(objectSize > 0)
+    {
+        int pad = max(prevBB.width, prevBB.height);
+        Rect predictedBB = prevBB + Point(cvRound(motion[0]), cvRound(motion[1]));
+        roi = prevBB | predictedBB;
+        covered = Rect(roi.x - pad / 2, roi.y - pad / 2, roi.width + pad, roi.height + pad) & frame;
+        roi = Rect(roi.x - pad, roi.y - pad, roi.width + 2 * pad, roi.height + 2 * pad) & frame;
+        roiScale = min(1.f, static_cast<float>(objectSize) / max(prevBB.width, prevBB.height));
+    }
+
+    int success;
 
-    IplImage prevImg = prevMat;
-    IplImage currImg = currMat;
+    if(roi == frame && roiScale == 1)
+    {
+        IplImage prevImg = prevMat;
+        IplImage currImg = currMat;
+
+        if(cropRoi.area() > 0)
+        {
+            //A crop at the origin starts at the address of its frame
+            invalidateLKCache(&lkCache);
+        }
+
+        success = fbtrack(&lkCache, &prevImg, &currImg, bb_tracker, bb_tracker, &scale, &fbError, maxPoints, motion, level, &scratch);
+        cropRoi = Rect();
+    }
+    else
+    {
+        //The crop of the previous call is kept while it covers the box with half of the padding and its scale
+        //is within 25% of the wanted one, so that the pyramid of its current frame is reused
+        bool reuseCrop = pyramidFrame.data == prevMat.data && (covered & cropRoi) == covered
+                && cropScale < roiScale * 1.25f && roiScale < cropScale * 1.25f;
 
-    int success = fbtrack(&prevImg, &currImg, bb_tracker, bb_tracker, &scale);
+        if(reuseCrop)
+        {
+            roi = cropRoi;
+            roiScale = cropScale;
+        }
+        else
+        {
+            //The buffer of the cached pyramid may be overwritten
+            invalidateLKCache(&lkCache);
+            cropFrame(prevMat, roi, roiScale, cropBuffers[currentCrop], crops[currentCrop]);
+        }
+
+        int next = 1 - currentCrop;
+        cropFrame(currMat, roi, roiScale, cropBuffers[next], crops[next]);
+        Mat &prevCrop = crops[currentCrop];
+        Mat &currCrop = crops[next];
+
+        //Pixel centers are mapped like resize() does
+        float sx = static_cast<float>(currCrop.cols) / roi.width;
+        float sy = static_cast<float>(currCrop.rows) / roi.height;
+
+        for(int i = 0; i < 4; i += 2)
+        {
+            bb_tracker[i] = (bb_tracker[i] - roi.x + 0.5f) * sx - 0.5f;
+            bb_tracker[i + 1] = (bb_tracker[i + 1] - roi.y + 0.5f) * sy - 0.5f;
+        }
+
+        //Distances shrink with the crop
+        float cropMotion[2] = {motion[0] * sx, motion[1] * sy};
+        int cropLevel = level;
+
+        if(motionModel && hasMotion)
+        {
+            cropLevel = levelForMotion((2 * motionError + 2) * max(sx, sy));
+        }
+
+        IplImage prevImg = prevCrop;
+        IplImage currImg = currCrop;
+
+        success = fbtrack(&lkCache, &prevImg, &currImg, bb_tracker, bb_tracker, &scale, &fbError, maxPoints, cropMotion, cropLevel, &scratch);
+        fbError /= min(sx, sy);
+        currentCrop = next;
+        cropRoi = roi;
+        cropScale = roiScale;
+
+        for(int i = 0; i < 4; i += 2)
+        {
+            bb_tracker[i] = (bb_tracker[i] + 0.5f) / sx - 0.5f + roi.x;
+            bb_tracker[i + 1] = (bb_tracker[i + 1] + 0.5f) / sy - 0.5f + roi.y;
+        }
+    }
+
+    pyramidFrame = currMat;
 
     //Extract subimage
     float x, y, w, h;
@@ -71,10 +234,21 @@ void MedianFlowTracker::track(Mat prevMat, Mat currMat, Rect &prevBB)
     if (!success || x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > currMat.cols || y + h > currMat.rows || x != x || y != y || w != w || h != h)
     { //x!=x is check for nan
         //Leave it empty
+        resetMotion();
     }
     else
     {
-        trackerBB.reset(new Rect(x, y, w, h));
+        trackerBB.reset(Rect(x, y, w, h));
+
+        float dx = (bb_tracker[0] + bb_tracker[2]) / 2 - prevCenterX;
+        float dy = (bb_tracker[1] + bb_tracker[3]) / 2 - prevCenterY;
+
+        //The expected error follows the recent prediction errors
+        float error = sqrt((dx - motion[0]) * (dx - motion[0]) + (dy - motion[1]) * (dy - motion[1]));
+        motionError = hasMotion ? (motionError + error) / 2 : error;
+        velocity[0] = dx;
+        velocity[1] = dy;
+        hasMotion = true;
     }
 }
 
@@ -27,7 +27,10 @@
 #define MEDIANFLOWTRACKER_H_
 
 #include <opencv/cv.h>
-#include <memory>
+
+#include "lk.h"
+#include "scratch.h"
+#include "OptionalRect.h"
 
 using namespace cv;
 using namespace std;
@@ -40,10 +43,33 @@ namespace tld
             MedianFlowTracker();
             virtual ~MedianFlowTracker();
             void cleanPreviousData();
-            void track(Mat prevImg, Mat currImg, Rect & prevBB);
+            void track(Mat prevImg, Mat currImg, Rect const & prevBB);
+            void resetMotion();
+            bool usesFrame(Mat const & frame) const { return frame.data != NULL && frame.data == pyramidFrame.data; } //The cached pyramid belongs to frame, so its memory must not be overwritten
 
         public:
-            shared_ptr<Rect> trackerBB;
+            OptionalRect trackerBB;
+            float fbError; //Median forward-backward error of the points in the last call of track(), in pixels of the frame
+            int maxPoints; //Budget of tracked points, placed on textured locations. 0 tracks a fixed 10x10 grid
+            bool nativeLK; //Tracks with the fixed-point kernel of lkfixed.h instead of cv::calcOpticalFlowPyrLK
+            ScratchArena scratch; //Working buffers of track(), reset by the owner after every frame
+            bool motionModel; //Seeds LK with a constant velocity prediction and uses only the pyramid levels needed for its expected error
+            int objectSize; //Tracking runs on a crop around the box, downscaled so that the larger side of the box is at most objectSize. 0 tracks on the full frames
+
+        private:
+            //The pyramid of the current frame is reused in the next call of track()
+            LKCache lkCache;
+            Mat pyramidFrame; //Keeps the frame of the cached pyramid alive, so its address is not reused
+            Rect cropRoi; //Crop of pyramidFrame in the last call, empty if it tracked on the full frames
+            float cropScale;
+            Mat cropBuffers[2]; //Downscaled crops, the buffers are reused and only grow
+            Mat crops[2]; //Crops of the previous and current frame, views of the frames if they are not downscaled
+            int currentCrop; //Index of the crop of pyramidFrame
+
+            //Constant velocity motion model, reset when tracking fails
+            bool hasMotion;
+            float velocity[2]; //Displacement of the box center in the last frame
+            float motionError; //Expected error of the prediction in pixels
     };
 
 } /* namespace tld */
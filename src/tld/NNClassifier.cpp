@@ -27,29 +27,222 @@
 #include "DetectorCascade.h"
 #include "TLDUtil.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace tld {
 
+//Value ranges of quantized patches. Query patches always use 16 bit, the range is chosen
+//such that the dot product of two 16 bit patches fits into 32 bit integers.
+static const int TLD_QUANTIZATION_RANGE_8 = 127;
+static const int TLD_QUANTIZATION_RANGE_16 = 2047;
+
+template <class T, int N>
+static void calcQuantizedStats(QuantizedPatch<T, N> & patch) {
+	int const size = N*N;
+	int sum = 0;
+	long long energy = 0;
+
+	for(int i = 0; i < size; i++) {
+		sum += patch.values[i];
+		energy += patch.values[i]*patch.values[i];
+	}
+
+	patch.mean = patch.scale * sum / size;
+	patch.norm = sqrt(max(0.0, (double)patch.scale*patch.scale*energy - size*(double)patch.mean*patch.mean));
+}
+
+template <class T, int N>
+static void quantizePatch(NormalizedPatch<N> const & patch, int range, QuantizedPatch<T, N> & result) {
+	int const size = N*N;
+	float maxAbs = 0;
+
+	for(int i = 0; i < size; i++) {
+		maxAbs = max(maxAbs, fabsf(patch.values[i]));
+	}
+
+	result.scale = (maxAbs > 0) ? maxAbs / range : 1;
+
+	for(int i = 0; i < size; i++) {
+		result.values[i] = cvRound(patch.values[i] / result.scale);
+	}
+
+	result.positive = patch.positive;
+	calcQuantizedStats(result);
+}
+
+//Integer dot products of quantized patches, the query patch is always 16 bit
+static int dotProduct(short const * a, short const * b, int n) {
+	int sum = 0;
+	int i = 0;
+
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+
+	for(; i + 8 <= n; i += 8) {
+		__m128i va = _mm_loadu_si128((__m128i const *)(a + i));
+		__m128i vb = _mm_loadu_si128((__m128i const *)(b + i));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+	}
+
+	int partial[4];
+	_mm_storeu_si128((__m128i *)partial, acc);
+	sum = partial[0] + partial[1] + partial[2] + partial[3];
+#endif
+
+	for(; i < n; i++) {
+		sum += a[i]*b[i];
+	}
+
+	return sum;
+}
+
+static int dotProduct(signed char const * a, short const * b, int n) {
+	int sum = 0;
+	int i = 0;
+
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+
+	for(; i + 8 <= n; i += 8) {
+		__m128i va = _mm_loadl_epi64((__m128i const *)(a + i));
+		va = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8); //Sign extension to 16 bit
+		__m128i vb = _mm_loadu_si128((__m128i const *)(b + i));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+	}
+
+	int partial[4];
+	_mm_storeu_si128((__m128i *)partial, acc);
+	sum = partial[0] + partial[1] + partial[2] + partial[3];
+#endif
+
+	for(; i < n; i++) {
+		sum += a[i]*b[i];
+	}
+
+	return sum;
+}
+
 NNClassifier::NNClassifier() {
 	thetaFP = .5;
 	thetaTP = .65;
+
+	coarseToFine = true;
+	numCandidates = 5;
+	coarseMargin = .1;
+
+	quantization = 0;
+
+	enabled = true;
+	windows = NULL;
 }
 
 NNClassifier::~NNClassifier() {
+}
+
+//Returns NULL if patchSize is not supported
+NNClassifier * NNClassifier::create(int patchSize) {
+	switch(patchSize) {
+	case 10: return new NNClassifierImpl<10>();
+	case 15: return new NNClassifierImpl<15>();
+	case 20: return new NNClassifierImpl<20>();
+	default: return NULL;
+	}
+}
+
+bool NNClassifier::isSupportedPatchSize(int patchSize) {
+	return patchSize == 10 || patchSize == 15 || patchSize == 20;
+}
+
+bool NNClassifier::isSupportedQuantization(int quantization) {
+	return quantization == 0 || quantization == 8 || quantization == 16;
+}
+
+//The samples are stored in one format only, so it cannot change once they exist
+bool NNClassifier::setQuantization(int quantization) {
+	if(!isSupportedQuantization(quantization)) {
+		return false;
+	}
+
+	if(quantization != this->quantization && numPositives() + numNegatives() > 0) {
+		return false;
+	}
+
+	this->quantization = quantization;
+	return true;
+}
+
+//Copies the configuration, but not the learned samples
+void NNClassifier::copySettings(NNClassifier const & other) {
+	enabled = other.enabled;
+	windows = other.windows;
+	thetaFP = other.thetaFP;
+	thetaTP = other.thetaTP;
+	coarseToFine = other.coarseToFine;
+	numCandidates = other.numCandidates;
+	coarseMargin = other.coarseMargin;
+	quantization = other.quantization;
+	detectionResult = other.detectionResult;
+}
+
+bool NNClassifier::filter(Mat const & img, int windowIdx) {
+	if(!enabled) return true;
+
+	float conf = classifyWindow(img, windowIdx);
+
+	if(conf < thetaTP) {
+		return false;
+	}
+
+	return true;
+}
+
+template <int N>
+NNClassifierImpl<N>::NNClassifierImpl() {
+	modelVersion = 0;
+}
+
+template <int N>
+NNClassifierImpl<N>::~NNClassifierImpl() {
     release();
 }
 
-void NNClassifier::release() {
+template <int N>
+void NNClassifierImpl<N>::release() {
+    modelVersion++;
     falsePositives.clear();
     truePositives.clear();
+    falsePositives8.clear();
+    truePositives8.clear();
+    falsePositives16.clear();
+    truePositives16.clear();
+}
+
+template <int N>
+size_t NNClassifierImpl<N>::numPositives() const {
+	switch(quantization) {
+	case 8: return truePositives8.size();
+	case 16: return truePositives16.size();
+	default: return truePositives.size();
+	}
+}
+
+template <int N>
+size_t NNClassifierImpl<N>::numNegatives() const {
+	switch(quantization) {
+	case 8: return falsePositives8.size();
+	case 16: return falsePositives16.size();
+	default: return falsePositives.size();
+	}
 }
 
-float NNClassifier::ncc(float const * f1,float const * f2) {
+template <int N>
+float NNClassifierImpl<N>::ncc(float const * f1,float const * f2, int size) {
 	double corr = 0;
 	double norm1 = 0;
 	double norm2 = 0;
 
-	int size = TLD_PATCH_SIZE*TLD_PATCH_SIZE;
-
 	for (int i = 0; i<size; i++) {
 		corr += f1[i]*f2[i];
 		norm1 += f1[i]*f1[i];
@@ -60,93 +253,420 @@ float NNClassifier::ncc(float const * f1,float const * f2) {
 	return (corr / sqrt(norm1*norm2) + 1) / 2.0;
 }
 
-float NNClassifier::classifyPatch(NormalizedPatch & patch) {
+//Computes the data classifyPatch needs besides the values. Must be called before a patch is stored.
+template <int N>
+void NNClassifierImpl<N>::preparePatch(NormalizedPatch<N> & patch) {
+	tldDownsamplePatch<N>(patch.values, patch.coarse);
 
-    if(truePositives.empty()) {
-		return 0;
+	int const size = N*N;
+	double energy = 0;
+
+	patch.tailNorms[TLD_NCC_NUM_CHUNKS] = 0;
+
+	for(int k = TLD_NCC_NUM_CHUNKS-1; k >= 0; k--) {
+		for(int i = k*size/TLD_NCC_NUM_CHUNKS; i < (k+1)*size/TLD_NCC_NUM_CHUNKS; i++) {
+			energy += patch.values[i]*patch.values[i];
+		}
+
+		patch.tailNorms[k] = sqrt(energy);
 	}
+}
 
-    if(falsePositives.empty()) {
-		return 1;
+//Same result as ncc() if it is larger than ccorr_max. Otherwise, the computation may be abandoned early and 0 is returned.
+//Patches are zero-mean, so by Cauchy-Schwarz the chunks not yet visited can add at most the product of their norms.
+template <int N>
+float NNClassifierImpl<N>::nccBounded(NormalizedPatch<N> const & sample, NormalizedPatch<N> const & patch, float ccorr_max) {
+	int const size = N*N;
+
+	double const norm = (double)sample.tailNorms[0]*patch.tailNorms[0];
+	double const threshold = (2*ccorr_max - 1) * norm - 1e-5 * norm; //ccorr_max in raw correlation units, with some slack for rounding
+
+	float const * f1 = sample.values;
+	float const * f2 = patch.values;
+	double corr = 0;
+
+	for(int k = 0; k < TLD_NCC_NUM_CHUNKS; k++) {
+		for(int i = k*size/TLD_NCC_NUM_CHUNKS; i < (k+1)*size/TLD_NCC_NUM_CHUNKS; i++) {
+			corr += f1[i]*f2[i];
+		}
+
+		if(corr + (double)sample.tailNorms[k+1]*patch.tailNorms[k+1] <= threshold) {
+			return 0;
+		}
 	}
 
-	float ccorr_max_p = 0;
+	return (corr / norm + 1) / 2.0;
+}
+
+//Returns the maximum correlation of patch with the given samples.
+//If candidates is not NULL, only the samples it indexes are considered.
+template <int N>
+float NNClassifierImpl<N>::maxCorrelation(vector<NormalizedPatch<N>> const & samples, NormalizedPatch<N> const & patch, int const * candidates, int numSamples)
+{
+    float ccorr_max = 0;
 
-	//Compare patch to positive patches
-    for (auto const & item : truePositives)
+    for(int i = 0; i < numSamples; i++)
     {
-        float const ccorr = ncc( item.values, patch.values );
+        NormalizedPatch<N> const & item = (candidates != NULL) ? samples[candidates[i]] : samples[i];
+        float const ccorr = nccBounded(item, patch, ccorr_max);
 
-        if(ccorr > ccorr_max_p)
+        if(ccorr > ccorr_max)
         {
-            ccorr_max_p = ccorr;
+            ccorr_max = ccorr;
         }
     }
 
-	float ccorr_max_n = 0;
+    return ccorr_max;
+}
+
+//Correlates the low resolution patches and keeps the indices of the numCandidates best samples,
+//sorted by descending coarse correlation. Returns the maximum coarse correlation.
+template <int N>
+float NNClassifierImpl<N>::selectCandidates(vector<NormalizedPatch<N>> const & samples, NormalizedPatch<N> const & patch, int * candidates, int & numSelected)
+{
+    int const maxSelected = max(1, min(numCandidates, TLD_NN_MAX_CANDIDATES));
+    float scores[TLD_NN_MAX_CANDIDATES];
+
+    numSelected = 0;
 
-	//Compare patch to positive patches
-    for(auto const & item : falsePositives)
+    for(size_t i = 0; i < samples.size(); i++)
     {
-        float const ccorr = ncc(item.values, patch.values);
+        float const ccorr = ncc(samples[i].coarse, patch.coarse, TLD_COARSE_PATCH_SIZE*TLD_COARSE_PATCH_SIZE);
 
-        if(ccorr > ccorr_max_n)
+        if(numSelected == maxSelected && ccorr <= scores[numSelected-1])
         {
-			ccorr_max_n = ccorr;
-		}
+            continue;
+        }
+
+        //Insertion into the (short) sorted candidate list
+        int pos = (numSelected < maxSelected) ? numSelected++ : numSelected-1;
+
+        while(pos > 0 && scores[pos-1] < ccorr)
+        {
+            scores[pos] = scores[pos-1];
+            candidates[pos] = candidates[pos-1];
+            pos--;
+        }
+
+        scores[pos] = ccorr;
+        candidates[pos] = i;
+    }
+
+    return (numSelected > 0) ? scores[0] : 0;
+}
+
+template <int N>
+template <class T>
+float NNClassifierImpl<N>::maxCorrelationQuantized(vector<QuantizedPatch<T, N> > const & samples, QuantizedPatch<short, N> const & patch) const
+{
+    int const size = N*N;
+    float ccorr_max = 0;
+
+    for(auto const & item : samples)
+    {
+        double const corr = (double)item.scale*patch.scale*dotProduct(item.values, patch.values, size) - size*(double)item.mean*patch.mean;
+        float const ccorr = (corr / ((double)item.norm*patch.norm) + 1) / 2.0;
+
+        if(ccorr > ccorr_max)
+        {
+            ccorr_max = ccorr;
+        }
+    }
+
+    return ccorr_max;
+}
+
+template <int N>
+float NNClassifierImpl<N>::classifyPatch(NormalizedPatch<N> & patch, bool useCascade) {
+
+    if(numPositives() == 0) {
+		return 0;
+	}
+
+    if(numNegatives() == 0) {
+		return 1;
 	}
 
+    float ccorr_max_p = 0;
+    float ccorr_max_n = 0;
+
+    if(quantization != 0)
+    {
+        QuantizedPatch<short, N> query;
+        quantizePatch(patch, TLD_QUANTIZATION_RANGE_16, query);
+
+        if(quantization == 8)
+        {
+            ccorr_max_p = maxCorrelationQuantized(truePositives8, query);
+            ccorr_max_n = maxCorrelationQuantized(falsePositives8, query);
+        }
+        else
+        {
+            ccorr_max_p = maxCorrelationQuantized(truePositives16, query);
+            ccorr_max_n = maxCorrelationQuantized(falsePositives16, query);
+        }
+    }
+    else if(useCascade && coarseToFine)
+    {
+        preparePatch(patch);
+
+        int candidatesP[TLD_NN_MAX_CANDIDATES];
+        int candidatesN[TLD_NN_MAX_CANDIDATES];
+        int numP, numN;
+
+        float const coarse_max_p = selectCandidates(truePositives, patch, candidatesP, numP);
+        float const coarse_max_n = selectCandidates(falsePositives, patch, candidatesN, numN);
+
+        float const coarseConf = (1-coarse_max_n)/((1-coarse_max_n)+(1-coarse_max_p));
+
+        //Clearly negative, not worth the full resolution comparison
+        if(coarseConf < thetaTP - coarseMargin)
+        {
+            return coarseConf;
+        }
+
+        ccorr_max_p = maxCorrelation(truePositives, patch, candidatesP, numP);
+        ccorr_max_n = maxCorrelation(falsePositives, patch, candidatesN, numN);
+    }
+    else
+    {
+        preparePatch(patch);
+
+        ccorr_max_p = maxCorrelation(truePositives, patch, NULL, truePositives.size());
+        ccorr_max_n = maxCorrelation(falsePositives, patch, NULL, falsePositives.size());
+    }
+
     float const dN = 1-ccorr_max_n;
     float const dP = 1-ccorr_max_p;
 
     return dN/(dN+dP);
 }
 
-float NNClassifier::classifyBB(Mat img, Rect & bb) {
-	NormalizedPatch patch;
+//Returns the cache entry of bb, the patch is extracted if it is not cached yet
+template <int N>
+typename PatchCache<N>::Entry & NNClassifierImpl<N>::extractBB(Mat const & img, Rect const & bb) {
+	typename PatchCache<N>::Entry * entry = cache.find(img, bb);
 
-	tldExtractNormalizedPatchRect(img, bb, patch.values);
-    return classifyPatch(patch);
+	if(entry == NULL) {
+		entry = &cache.add(img, bb);
+		tldExtractNormalizedPatchRect<N>(img, bb, entry->patch.values);
+	}
 
+	return *entry;
 }
 
-float NNClassifier::classifyWindow(Mat img, int windowIdx) {
-	NormalizedPatch patch;
-
-	int * bbox = &windows[TLD_WINDOW_SIZE*windowIdx];
-	tldExtractNormalizedPatchBB(img, bbox, patch.values);
+//Classifies the patch of the entry, unless it has been classified by the current model already
+template <int N>
+float NNClassifierImpl<N>::classifyEntry(typename PatchCache<N>::Entry & entry) {
+	if(!entry.hasConfidence || entry.modelVersion != modelVersion) {
+		entry.confidence = classifyPatch(entry.patch);
+		entry.modelVersion = modelVersion;
+		entry.hasConfidence = true;
+	}
 
-    return classifyPatch(patch);
+	return entry.confidence;
 }
 
-bool NNClassifier::filter(Mat img, int windowIdx) {
-	if(!enabled) return true;
+template <int N>
+float NNClassifierImpl<N>::classifyBB(Mat const & img, Rect const & bb) {
+    return classifyEntry(extractBB(img, bb));
+}
 
-	float conf = classifyWindow(img, windowIdx);
+//The patch is kept for learn(), the confidence is not, as the cascade may stop at low resolution
+template <int N>
+float NNClassifierImpl<N>::classifyWindow(Mat const & img, int windowIdx) {
+	NormalizedPatch<N> local;
+	NormalizedPatch<N> * patch = cache.addWindow(img, windowIdx);
 
-	if(conf < thetaTP) {
-		return false;
+	if(patch == NULL) {
+		patch = &local;
 	}
 
-	return true;
+	int * bbox = &windows[TLD_WINDOW_SIZE*windowIdx];
+	tldExtractNormalizedPatchBB<N>(img, bbox, patch->values);
+
+    return classifyPatch(*patch, true);
 }
 
-void NNClassifier::learn(vector<NormalizedPatch> & patches) {
+template <int N>
+void NNClassifierImpl<N>::learn(vector<NormalizedPatch<N>> & patches) {
 	//TODO: Randomization might be a good idea here
 
     for (auto & patch : patches)
     {
         float conf = classifyPatch(patch);
 
-		if(patch.positive && conf <= thetaTP) {
-            truePositives.push_back(patch);
+		if((patch.positive && conf <= thetaTP) || (!patch.positive && conf >= thetaFP)) {
+            addSample(patch);
 		}
+	}
+}
+
+template <int N>
+float NNClassifierImpl<N>::calcPatchVariance(Mat const & img, Rect const & bb) {
+	return tldCalcVariance(extractBB(img, bb).patch.values, N*N);
+}
+
+//Learns the patch at positiveBB as positive sample and the given windows as negative samples.
+//Patches and the confidence of positiveBB are taken from the cache where possible.
+template <int N>
+void NNClassifierImpl<N>::learn(Mat const & img, Rect const & positiveBB, vector<int> const & negativeWindows) {
+	typename PatchCache<N>::Entry & positive = extractBB(img, positiveBB);
+	positive.patch.positive = 1;
+
+	if(classifyEntry(positive) <= thetaTP) {
+		addSample(positive.patch);
+	}
+
+	vector<NormalizedPatch<N> > & patches = learnPatches;
+	patches.resize(negativeWindows.size());
+
+	for(size_t i = 0; i < negativeWindows.size(); i++) {
+		NormalizedPatch<N> const * cached = cache.findWindow(img, negativeWindows[i]);
+
+		if(cached != NULL) {
+			patches[i] = *cached;
+		} else {
+			int * bbox = &windows[TLD_WINDOW_SIZE*negativeWindows[i]];
+			tldExtractNormalizedPatchBB<N>(img, bbox, patches[i].values);
+		}
+
+		patches[i].positive = 0;
+	}
+
+	learn(patches);
+}
+
+template <int N>
+void NNClassifierImpl<N>::addSample(NormalizedPatch<N> const & patch) {
+	modelVersion++;
+
+	if(quantization == 8) {
+		QuantizedPatch<signed char, N> sample;
+		quantizePatch(patch, TLD_QUANTIZATION_RANGE_8, sample);
+		(patch.positive ? truePositives8 : falsePositives8).push_back(sample);
+	} else if(quantization == 16) {
+		QuantizedPatch<short, N> sample;
+		quantizePatch(patch, TLD_QUANTIZATION_RANGE_16, sample);
+		(patch.positive ? truePositives16 : falsePositives16).push_back(sample);
+	} else {
+		NormalizedPatch<N> sample = patch;
+		preparePatch(sample); //classifyPatch returns early while a class is still empty
+		(patch.positive ? truePositives : falsePositives).push_back(sample);
+	}
+}
+
+template <int N>
+static void writePatchValues(FILE * file, float const * values) {
+	for(int i = 0; i < N; i++) {
+		for(int j = 0; j < N; j++) {
+			fprintf(file, "%f ", values[i*N+j]);
+		}
+		fprintf(file, "\n");
+	}
+}
+
+template <int N, class T>
+static void writePatchValues(FILE * file, T const * values) {
+	for(int i = 0; i < N; i++) {
+		for(int j = 0; j < N; j++) {
+			fprintf(file, "%d ", (int)values[i*N+j]);
+		}
+		fprintf(file, "\n");
+	}
+}
+
+template <class T, int N>
+static void writeQuantizedSamples(FILE * file, vector<QuantizedPatch<T, N> > const & samples) {
+	for(auto const & sample : samples) {
+		fprintf(file, "%g #scale\n", sample.scale);
+		writePatchValues<N>(file, sample.values);
+	}
+}
+
+//Reads the N rows of N values value by value, so rows of any length are read whole
+template <int N, class T>
+static void readPatchValues(FILE * file, T * values) {
+	for(int i = 0; i < N*N; i++) {
+		float value = 0;
+		fscanf(file, "%f", &value);
+		values[i] = value;
+	}
+}
+
+template <class T, int N>
+static void readQuantizedSamples(FILE * file, int numSamples, bool positive, vector<QuantizedPatch<T, N> > & samples) {
+	int const MAX_LEN = 255;
+	char str_buf[MAX_LEN];
+
+	for(int s = 0; s < numSamples; s++) {
+		QuantizedPatch<T, N> sample;
+		fscanf(file, "%f", &sample.scale);
+		fgets(str_buf, MAX_LEN, file); /*Skip rest of line*/
+
+		readPatchValues<N>(file, sample.values);
+		sample.positive = positive;
+		calcQuantizedStats(sample);
+		samples.push_back(sample);
+	}
+}
+
+//Writes the positive and the negative samples, in the format given by quantization
+template <int N>
+void NNClassifierImpl<N>::writeToFile(FILE * file) const {
+	fprintf(file,"%d #Positive Sample Size\n", (int) numPositives());
+
+	switch(quantization) {
+	case 8: writeQuantizedSamples(file, truePositives8); break;
+	case 16: writeQuantizedSamples(file, truePositives16); break;
+	default:
+		for(auto const & sample : truePositives) {
+			writePatchValues<N>(file, sample.values);
+		}
+	}
+
+	fprintf(file,"%d #Negative Sample Size\n", (int) numNegatives());
+
+	switch(quantization) {
+	case 8: writeQuantizedSamples(file, falsePositives8); break;
+	case 16: writeQuantizedSamples(file, falsePositives16); break;
+	default:
+		for(auto const & sample : falsePositives) {
+			writePatchValues<N>(file, sample.values);
+		}
+	}
+}
 
-		if(!patch.positive && conf >= thetaFP) {
-            falsePositives.push_back(patch);
+//Reads samples written by writeToFile. quantization must match the format of the file.
+template <int N>
+void NNClassifierImpl<N>::readFromFile(FILE * file) {
+	int const MAX_LEN = 255;
+	char str_buf[MAX_LEN];
+
+	modelVersion++;
+
+	for(int positive = 1; positive >= 0; positive--) {
+		int numSamples;
+		fscanf(file, "%d \n", &numSamples);
+		fgets(str_buf, MAX_LEN, file); /*Skip line*/
+
+		switch(quantization) {
+		case 8: readQuantizedSamples(file, numSamples, positive, positive ? truePositives8 : falsePositives8); break;
+		case 16: readQuantizedSamples(file, numSamples, positive, positive ? truePositives16 : falsePositives16); break;
+		default:
+			for(int s = 0; s < numSamples; s++) {
+				NormalizedPatch<N> patch;
+				readPatchValues<N>(file, patch.values);
+				patch.positive = positive;
+				preparePatch(patch);
+				(positive ? truePositives : falsePositives).push_back(patch);
+			}
 		}
 	}
 }
 
+template class NNClassifierImpl<10>;
+template class NNClassifierImpl<15>;
+template class NNClassifierImpl<20>;
 
 } /* namespace tld */
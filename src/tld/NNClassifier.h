@@ -27,10 +27,12 @@
 #define NNCLASSIFIER_H_
 
 #include <vector>
+#include <cstdio>
 #include <opencv/cv.h>
 #include <memory>
 
 #include "NormalizedPatch.h"
+#include "PatchCache.h"
 #include "DetectionResult.h"
 
 using namespace std;
@@ -38,28 +40,106 @@ using namespace cv;
 
 namespace tld {
 
-class NNClassifier {
-    float ncc(float const *f1, float const *f2);
+//Upper bound for numCandidates
+static const int TLD_NN_MAX_CANDIDATES = 16;
 
+//Interface of the nearest neighbour classifier, independent of the patch size.
+//Use create() to get an instance for a given patch size.
+class NNClassifier {
 public:
 	bool enabled;
 
 	int * windows;
 	float thetaFP;
 	float thetaTP;
+
+	//Coarse-to-fine cascade used by filter(): correlations are first computed on the low resolution patches
+	bool coarseToFine;
+	int numCandidates; //Number of samples per class that are compared at full resolution
+	float coarseMargin; //Windows with a coarse confidence below thetaTP - coarseMargin are rejected right away
+
+	//0 stores samples as floats, 8 or 16 stores them quantized to int8/int16. Set with setQuantization() before learning.
+	//Quantized samples are always compared with the plain NCC at full resolution: the coarse-to-fine cascade
+	//and the bounded NCC are only used with float samples.
+	int quantization;
+
     std::shared_ptr<DetectionResult> detectionResult;
-    vector<NormalizedPatch> falsePositives;
-    vector<NormalizedPatch> truePositives;
+
+	static NNClassifier * create(int patchSize);
+	static bool isSupportedPatchSize(int patchSize);
+	static bool isSupportedQuantization(int quantization);
 
 	NNClassifier();
 	virtual ~NNClassifier();
 
+	void copySettings(NNClassifier const & other);
+	bool setQuantization(int quantization); //False if it is not supported, or if samples of another format were learned
+
+	virtual int patchSize() const = 0;
+	virtual NNClassifier * clone() const = 0; //Copies settings and samples
+	virtual bool copyFrom(NNClassifier const & other) = 0; //Copies settings and samples of other into the memory of this one, false if the patch sizes differ
+	virtual void release() = 0;
+	virtual size_t numPositives() const = 0;
+	virtual size_t numNegatives() const = 0;
+	virtual float classifyBB(Mat const & img, Rect const & bb) = 0;
+	virtual float classifyWindow(Mat const & img, int windowIdx) = 0;
+	virtual float calcPatchVariance(Mat const & img, Rect const & bb) = 0;
+	virtual void learn(Mat const & img, Rect const & positiveBB, vector<int> const & negativeWindows) = 0;
+	virtual void beginFrame(Mat const & img, int numWindows) = 0; //Patches of img are extracted only once until the next call
+	virtual void writeToFile(FILE * file) const = 0;
+	virtual void readFromFile(FILE * file) = 0;
+	bool filter(Mat const & img, int windowIdx);
+};
+
+template <int N>
+class NNClassifierImpl : public NNClassifier {
+    float ncc(float const *f1, float const *f2, int size);
+    float nccBounded(NormalizedPatch<N> const & sample, NormalizedPatch<N> const & patch, float ccorr_max);
+    float maxCorrelation(vector<NormalizedPatch<N> > const & samples, NormalizedPatch<N> const & patch, int const * candidates, int numSamples);
+    float selectCandidates(vector<NormalizedPatch<N> > const & samples, NormalizedPatch<N> const & patch, int * candidates, int & numSelected);
+    template <class T> float maxCorrelationQuantized(vector<QuantizedPatch<T, N> > const & samples, QuantizedPatch<short, N> const & patch) const;
+    void addSample(NormalizedPatch<N> const & patch);
+    typename PatchCache<N>::Entry & extractBB(Mat const & img, Rect const & bb);
+    float classifyEntry(typename PatchCache<N>::Entry & entry);
+
+    vector<NormalizedPatch<N> > learnPatches; //Working buffer of learn(), kept so that its memory is reused
+    PatchCache<N> cache;
+    unsigned modelVersion; //Changes with every modification of the samples, invalidates the cached confidences
+
+public:
+    vector<NormalizedPatch<N> > falsePositives;
+    vector<NormalizedPatch<N> > truePositives;
+    vector<QuantizedPatch<signed char, N> > falsePositives8;
+    vector<QuantizedPatch<signed char, N> > truePositives8;
+    vector<QuantizedPatch<short, N> > falsePositives16;
+    vector<QuantizedPatch<short, N> > truePositives16;
+
+	NNClassifierImpl();
+	virtual ~NNClassifierImpl();
+
+	int patchSize() const { return N; }
+	NNClassifier * clone() const { return new NNClassifierImpl<N>(*this); }
+
+	bool copyFrom(NNClassifier const & other) {
+		NNClassifierImpl<N> const * impl = dynamic_cast<NNClassifierImpl<N> const *>(&other);
+		if(impl == NULL) return false;
+		*this = *impl; //The sample vectors keep their capacity
+		return true;
+	}
+
 	void release();
-    float classifyPatch(NormalizedPatch & patch);
-    float classifyBB(Mat img, Rect &bb);
-	float classifyWindow(Mat img, int windowIdx);
-	void learn(vector<NormalizedPatch> &patches);
-	bool filter(Mat img, int windowIdx);
+	size_t numPositives() const;
+	size_t numNegatives() const;
+	void preparePatch(NormalizedPatch<N> & patch);
+    float classifyPatch(NormalizedPatch<N> & patch, bool useCascade = false);
+    float classifyBB(Mat const & img, Rect const & bb);
+	float classifyWindow(Mat const & img, int windowIdx);
+	float calcPatchVariance(Mat const & img, Rect const & bb);
+	void learn(vector<NormalizedPatch<N> > &patches);
+	void learn(Mat const & img, Rect const & positiveBB, vector<int> const & negativeWindows);
+	void beginFrame(Mat const & img, int numWindows) { cache.begin(img, numWindows); }
+	void writeToFile(FILE * file) const;
+	void readFromFile(FILE * file);
 };
 
 } /* namespace tld */
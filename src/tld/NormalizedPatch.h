@@ -26,13 +26,32 @@
 #ifndef NORMALIZEDPATCH_H_
 #define NORMALIZEDPATCH_H_
 
-#define TLD_PATCH_SIZE 15
+#define TLD_PATCH_SIZE 15 //Default patch size
+#define TLD_COARSE_PATCH_SIZE 5 //Supported patch sizes must be multiples of this
+#define TLD_NCC_NUM_CHUNKS 5
 
 namespace tld {
 
+template <int N>
 class NormalizedPatch {
 public:
-	float values[TLD_PATCH_SIZE*TLD_PATCH_SIZE];
+	static const int size = N;
+
+	float values[N*N];
+	float coarse[TLD_COARSE_PATCH_SIZE*TLD_COARSE_PATCH_SIZE]; //Block-averaged low resolution version of values, see tldDownsamplePatch
+	float tailNorms[TLD_NCC_NUM_CHUNKS+1]; //tailNorms[k] is the norm of the values from chunk k on, tailNorms[0] is the norm of the patch
+	bool positive;
+};
+
+//Compact version of a NormalizedPatch. T is a signed integer type.
+//The zero-mean patch is approximately values[i]*scale - mean.
+template <class T, int N>
+class QuantizedPatch {
+public:
+	T values[N*N];
+	float scale;
+	float mean; //Mean of values[i]*scale, left over from rounding
+	float norm; //Norm of the zero-mean patch
 	bool positive;
 };
 
@@ -0,0 +1,55 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+/*
+ * OptionalRect.h
+ */
+
+#ifndef OPTIONALRECT_H_
+#define OPTIONALRECT_H_
+
+#include <cstddef>
+#include <opencv/cv.h>
+
+using namespace cv;
+
+namespace tld {
+
+//A bounding box that may be missing. Stored by value, so results can be set every frame without allocations.
+//Access works like with a pointer: if(bb), bb->x, *bb, bb.get(), bb.reset().
+class OptionalRect {
+public:
+	OptionalRect() : valid(false) {}
+	OptionalRect(Rect const & r) : rect(r), valid(true) {}
+
+	explicit operator bool() const { return valid; }
+
+	Rect const & operator*() const { return rect; }
+	Rect const * operator->() const { return &rect; }
+	Rect const * get() const { return valid ? &rect : NULL; } //NULL if there is no box
+
+	void reset() { valid = false; }
+	void reset(Rect const & r) { rect = r; valid = true; }
+
+private:
+	Rect rect;
+	bool valid;
+};
+
+} /* namespace tld */
+#endif /* OPTIONALRECT_H_ */
@@ -0,0 +1,150 @@
+/*  Copyright 2011 AIT Austrian Institute of Technology
+*
+*   This file is part of OpenTLD.
+*
+*   OpenTLD is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   OpenTLD is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with OpenTLD.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+/*
+ * PatchCache.h
+ */
+
+#ifndef PATCHCACHE_H_
+#define PATCHCACHE_H_
+
+#include <vector>
+#include <atomic>
+#include <opencv/cv.h>
+
+#include "NormalizedPatch.h"
+
+using namespace std;
+using namespace cv;
+
+namespace tld {
+
+#define TLD_PATCH_CACHE_SIZE 8 //Number of bounding boxes kept per frame
+
+//Patches extracted from one frame, so that every region is extracted only once per frame, and NN confidences
+//of bounding boxes. Only used for the frame passed to begin(). Copies start empty, so a classifier can be
+//cloned while its cache is in use.
+template <int N>
+class PatchCache {
+public:
+	struct Entry {
+		Rect bb;
+		NormalizedPatch<N> patch;
+		bool hasConfidence;
+		float confidence;
+		unsigned modelVersion; //Version of the classifier the confidence belongs to
+	};
+
+	PatchCache() { clear(); }
+	PatchCache(PatchCache const &) { clear(); }
+	PatchCache & operator=(PatchCache const &) { clear(); return *this; }
+
+	//Drops everything and caches the patches of img from now on. The buffers of the window patches grow to the demand of the last frame.
+	void begin(Mat const & img, int numWindows) {
+		int const demand = numWindowSlots;
+
+		if(windowSlots.size() != (size_t) numWindows) {
+			windowSlots.assign(numWindows, -1);
+		} else {
+			for(int i = 0; i < min<int>(demand, slotWindows.size()); i++) {
+				windowSlots[slotWindows[i]] = -1;
+			}
+		}
+
+		if((size_t) demand > windowPatches.size()) {
+			windowPatches.resize(min(demand, numWindows));
+			slotWindows.resize(windowPatches.size());
+		}
+
+		image = img.data;
+		rows = img.rows;
+		cols = img.cols;
+		numEntries = 0;
+		numWindowSlots = 0;
+	}
+
+	bool contains(Mat const & img) const {
+		return image != NULL && img.data == image && img.rows == rows && img.cols == cols;
+	}
+
+	//Returns the entry of bb, or NULL
+	Entry * find(Mat const & img, Rect const & bb) {
+		if(!contains(img)) return NULL;
+
+		for(int i = 0; i < min(numEntries, TLD_PATCH_CACHE_SIZE); i++) {
+			if(entries[i].bb == bb) return &entries[i];
+		}
+
+		return NULL;
+	}
+
+	//Returns an empty entry for bb. The oldest entry is replaced if the cache is full.
+	//If img is not the cached frame, a scratch entry is returned, which is overwritten by the next call.
+	Entry & add(Mat const & img, Rect const & bb) {
+		Entry & entry = contains(img) ? entries[numEntries++ % TLD_PATCH_CACHE_SIZE] : scratch;
+		entry.bb = bb;
+		entry.hasConfidence = false;
+		return entry;
+	}
+
+	//Returns the buffer for the patch of a window, or NULL if the buffers are used up. Thread-safe for different windows.
+	NormalizedPatch<N> * addWindow(Mat const & img, int windowIdx) {
+		if(!contains(img) || windowIdx >= (int) windowSlots.size()) return NULL;
+
+		int const slot = numWindowSlots++;
+
+		if(slot >= (int) windowPatches.size()) return NULL;
+
+		slotWindows[slot] = windowIdx;
+		windowSlots[windowIdx] = slot;
+		return &windowPatches[slot];
+	}
+
+	//Returns the patch of a window extracted from img, or NULL
+	NormalizedPatch<N> const * findWindow(Mat const & img, int windowIdx) const {
+		if(!contains(img) || windowIdx >= (int) windowSlots.size()) return NULL;
+
+		int const slot = windowSlots[windowIdx];
+		return (slot >= 0) ? &windowPatches[slot] : NULL;
+	}
+
+private:
+	void clear() {
+		image = NULL;
+		rows = 0;
+		cols = 0;
+		numEntries = 0;
+		numWindowSlots = 0;
+	}
+
+	uchar const * image;
+	int rows;
+	int cols;
+
+	Entry entries[TLD_PATCH_CACHE_SIZE];
+	int numEntries; //Number of calls of add(), entries are reused round robin
+	Entry scratch;
+
+	vector<NormalizedPatch<N> > windowPatches;
+	vector<int> slotWindows; //Window of each used buffer
+	vector<int> windowSlots; //Buffer of each window, -1 if it has not been extracted
+	atomic<int> numWindowSlots; //Requested buffers, may exceed the size of windowPatches
+};
+
+} /* namespace tld */
+#endif /* PATCHCACHE_H_ */
@@ -37,10 +37,45 @@ TLD::TLD() {
 	detectorEnabled = true;
 	learningEnabled = true;
 	alternating = false;
+	concurrentTracking = false;
 	valid = false;
 	wasValid = false;
 	learning = false;
 
+	numWarps = 20;
+
+	selectionTick = 0;
+	selectionToFirstTrack = -1;
+	numFramesSinceSelection = 0;
+
+	maxDetectionInterval = 1;
+	detectionConfidence = 0.7;
+	maxDetectionFbError = 1;
+	maxDetectionMotion = 0.1;
+	detectionInterval = 1;
+	framesSinceFullScan = 0;
+	detectionMode = DETECTION_NONE;
+
+	learningConfidence = 1;
+	maxPositives = 10;
+	maxNegatives = 0;
+	maxNegativesNN = 0;
+	numLearnedSamples = 0;
+	syncJob.reset(new LearningJob());
+
+	for(int i = 0; i < 3; i++) {
+		asyncJobs[i].reset(new LearningJob());
+	}
+
+	asyncLearning = false;
+	learningBusy = false;
+	modelReady = false;
+	stopLearning = false;
+
+	trackerFrameStart = 0;
+	trackerBusy = false;
+	stopTracker = false;
+
     detectorCascade.reset( new DetectorCascade() );
     medianFlowTracker.reset( new MedianFlowTracker() );
 
@@ -49,13 +84,29 @@ TLD::TLD() {
 }
 
 TLD::~TLD() {
+	setConcurrentTracking(false);
+	setAsyncLearning(false);
 	storeCurrentData();
     if(_img_posterios)cvReleaseImage(&_img_posterios);
 }
 
+//Discards the learned NN samples if the size changes
+bool TLD::setPatchSize(int patchSize) {
+	waitForLearning();
+
+	if(!detectorCascade->setPatchSize(patchSize)) {
+		return false;
+	}
+
+    nnClassifier = detectorCascade->nnClassifier;
+	return true;
+}
+
 void TLD::release() {
+	waitForLearning();
 	detectorCascade->release();
     medianFlowTracker->cleanPreviousData();
+    medianFlowTracker->resetMotion();
 }
 
 void TLD::storeCurrentData() {
@@ -70,8 +121,16 @@ void TLD::storeCurrentData() {
 }
 
 void TLD::selectObject(Mat img, Rect const & bb) {
+	selectionTick = cvGetTickCount();
+	selectionToFirstTrack = -1;
+	numFramesSinceSelection = 0;
+	detectionInterval = 1;
+	framesSinceFullScan = 0;
+
 	//Delete old object
+	waitForLearning();
 	detectorCascade->release();
+	medianFlowTracker->resetMotion();
 
 	//Init detector cascade
     detectorCascade->objWidth = bb.width;
@@ -79,7 +138,8 @@ void TLD::selectObject(Mat img, Rect const & bb) {
 	detectorCascade->init();
 
 	currImg = img;
-    currBB.reset(new Rect(bb));
+	nnClassifier->beginFrame(currImg, detectorCascade->numWindows);
+    currBB.reset(bb);
 	currConf = 1;
 	valid = true;
 
@@ -89,22 +149,161 @@ void TLD::selectObject(Mat img, Rect const & bb) {
 
 void TLD::processImage(Mat img)
 {
+	double const frameStart = cvGetTickCount() / cvGetTickFrequency() / 1000;
+
+	publishLearnedModel();
 	storeCurrentData();
-	Mat grey_frame;
+	//The frame is converted into a buffer that is neither the previous frame nor the frame of the tracker's pyramid,
+	//so that the memory of the frames is reused
+	int frameBuffer = 0;
+
+	while(greyFrames[frameBuffer].data != NULL
+			&& (greyFrames[frameBuffer].data == prevImg.data || medianFlowTracker->usesFrame(greyFrames[frameBuffer]))) {
+		frameBuffer++;
+	}
+
+	Mat & grey_frame = greyFrames[frameBuffer];
 	cvtColor( img,grey_frame, CV_RGB2GRAY );
 	currImg = grey_frame; // Store new image , right after storeCurrentData();
+	nnClassifier->beginFrame(currImg, detectorCascade->numWindows); //Patches and NN confidences are reused within the frame
+
+	//Between two full scans, the detector only verifies the surroundings of the tracker result
+	bool const fullScan = alternating || !prevBB || framesSinceFullScan + 1 >= detectionInterval;
+	detectionMode = DETECTION_NONE;
+
+	//Tracker and detector only share the frames, which they do not modify. So the tracker runs on its own thread
+	//while the detector scans, unless the detector needs the tracker result (alternating mode, local scan).
+	bool trackingConcurrently = false;
 
     if(trackerEnabled && prevBB)
     {
-        medianFlowTracker->track(prevImg, currImg, *prevBB.get());
+		if(concurrentTracking && detectorEnabled && !alternating && fullScan) {
+			startTracking(frameStart);
+			trackingConcurrently = true;
+		} else {
+			medianFlowTracker->track(prevImg, currImg, *prevBB);
+			publishTrackerResult(frameStart);
+		}
 	}
 
-	if(detectorEnabled && (!alternating || medianFlowTracker->trackerBB == NULL)) {
+	//trackerBB is only read here if the tracker did not run on its own thread
+	if(detectorEnabled && !fullScan && medianFlowTracker->trackerBB) {
+		Rect const & bb = *medianFlowTracker->trackerBB;
+		detectorCascade->detectLocal(grey_frame, Rect(bb.x - bb.width / 2, bb.y - bb.height / 2, 2 * bb.width, 2 * bb.height));
+		detectionMode = DETECTION_LOCAL;
+	} else if(detectorEnabled && (!alternating || !medianFlowTracker->trackerBB)) {
 		detectorCascade->detect(grey_frame);
+		detectionMode = DETECTION_FULL;
+	}
+
+	if(trackingConcurrently) {
+		waitForTracking();
 	}
 
 	fuseHypotheses();
 	learn();
+	updateDetectionSchedule();
+
+	//All working buffers of the frame are freed at once
+	resetScratchArena(&detectorCascade->scratch);
+	resetScratchArena(&medianFlowTracker->scratch);
+
+	//The latency is only known if the object was selected with selectObject()
+	if(++numFramesSinceSelection == 1 && selectionTick != 0) {
+		selectionToFirstTrack = (cvGetTickCount() - selectionTick) / cvGetTickFrequency() / 1000;
+	}
+
+	publishResult(frameStart);
+}
+
+void TLD::setResultCallbacks(TLDResultCallback const & onProvisional, TLDResultCallback const & onFinal) {
+	provisionalCallback = onProvisional;
+	finalCallback = onFinal;
+}
+
+void TLD::setConcurrentTracking(bool status) {
+	if(status == concurrentTracking) return;
+
+	if(status) {
+		stopTracker = false;
+		concurrentTracking = true;
+		trackerThread = std::thread(&TLD::trackerLoop, this);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(trackerMutex);
+		stopTracker = true;
+		trackerCondition.notify_all();
+	}
+
+	trackerThread.join();
+	concurrentTracking = false;
+}
+
+//Hands the current frame to the tracker thread. Frames and boxes are not modified until waitForTracking() returns.
+void TLD::startTracking(double frameStart) {
+	lock_guard<mutex> lock(trackerMutex);
+	trackerFrameStart = frameStart;
+	trackerBusy = true;
+	trackerCondition.notify_all();
+}
+
+void TLD::waitForTracking() {
+	unique_lock<mutex> lock(trackerMutex);
+	trackerCondition.wait(lock, [this] { return !trackerBusy; });
+}
+
+//Runs on the tracker thread, it sleeps between the frames
+void TLD::trackerLoop() {
+	unique_lock<mutex> lock(trackerMutex);
+
+	while(true) {
+		trackerCondition.wait(lock, [this] { return stopTracker || trackerBusy; });
+
+		if(stopTracker) return;
+
+		double const frameStart = trackerFrameStart;
+		lock.unlock();
+
+		medianFlowTracker->track(prevImg, currImg, *prevBB);
+		publishTrackerResult(frameStart);
+
+		lock.lock();
+		trackerBusy = false;
+		trackerCondition.notify_all();
+	}
+}
+
+//Publishes the tracker estimate before the detector is done. Is called on the tracker thread if the tracker runs concurrently.
+void TLD::publishTrackerResult(double frameStart) {
+	if(!provisionalCallback) return;
+
+	TLDResult result;
+	result.frame = numFramesSinceSelection + 1;
+	result.bb = medianFlowTracker->trackerBB;
+	result.confidence = -1;
+	result.valid = false;
+	result.provisional = true;
+	result.frameStart = frameStart;
+	result.timestamp = cvGetTickCount() / cvGetTickFrequency() / 1000;
+
+	provisionalCallback(result);
+}
+
+void TLD::publishResult(double frameStart) {
+	if(!finalCallback) return;
+
+	TLDResult result;
+	result.frame = numFramesSinceSelection;
+	result.bb = currBB;
+	result.confidence = currConf;
+	result.valid = valid;
+	result.provisional = false;
+	result.frameStart = frameStart;
+	result.timestamp = cvGetTickCount() / cvGetTickFrequency() / 1000;
+
+	finalCallback(result);
 }
 
 
@@ -136,12 +335,12 @@ void TLD::fuseHypotheses() {
         if(numClusters == 1 && confDetector > confTracker && tldOverlapRectRect(*trackerBB.get(), *detectorBB.get()) < 0.5)
         {
 
-            currBB.reset(new Rect(*detectorBB.get()));
+            currBB.reset(*detectorBB);
 			currConf = confDetector;
         }
         else
         {
-            currBB.reset( new Rect(*trackerBB.get()));
+            currBB.reset(*trackerBB);
 			currConf = confTracker;
 
             if(confTracker > nnClassifier->thetaTP)
@@ -156,7 +355,7 @@ void TLD::fuseHypotheses() {
     }
     else if(numClusters == 1)
     {
-        currBB.reset( new Rect(*detectorBB.get()));
+        currBB.reset(*detectorBB);
 		currConf = confDetector;
 	}
 
@@ -176,46 +375,24 @@ void TLD::initialLearning() {
 
 	detectorCascade->detect(currImg);
 
-	//This is the positive patch
-	NormalizedPatch patch;
-    tldExtractNormalizedPatchRect(currImg, *currBB.get(), patch.values);
-	patch.positive = 1;
-
-	float initVar = tldCalcVariance(patch.values, TLD_PATCH_SIZE*TLD_PATCH_SIZE);
+	float initVar = nnClassifier->calcPatchVariance(currImg, *currBB.get());
 	detectorCascade->varianceFilter->minVar = initVar/2;
 
 
-	float * overlap = new float[detectorCascade->numWindows];
-    tldOverlapRect(detectorCascade->windows, detectorCascade->numWindows, *currBB.get(), overlap);
-
 	//Add all bounding boxes with high overlap
 
 	vector< pair<int,float> > positiveIndices;
 	vector<int> negativeIndices;
 
 	//First: Find overlapping positive and negative patches
+	detectorCascade->findOverlappingWindows(*currBB.get(), 0.6, positiveIndices);
 
-	for(int i = 0; i < detectorCascade->numWindows; i++) {
-
-		if(overlap[i] > 0.6) {
-			positiveIndices.push_back(pair<int,float>(i,overlap[i]));
-		}
-
-		if(overlap[i] < 0.2) {
-			float variance = detectionResult->variances[i];
-
-			if(!detectorCascade->varianceFilter->enabled || variance > detectorCascade->varianceFilter->minVar) { //TODO: This check is unnecessary if minVar would be set before calling detect.
-				negativeIndices.push_back(i);
-			}
-		}
-	}
+	//TODO: The variance check is unnecessary if minVar would be set before calling detect.
+	float const minVar = detectorCascade->varianceFilter->enabled ? detectorCascade->varianceFilter->minVar : -1;
+	detectorCascade->findNegativeWindows(*currBB.get(), 0.2, detectionResult->variances, minVar, negativeIndices);
 
 	sort(positiveIndices.begin(), positiveIndices.end(), tldSortByOverlapDesc);
 
-	vector<NormalizedPatch> patches;
-
-	patches.push_back(patch); //Add first patch to patch list
-
 	int numIterations = min<size_t>(positiveIndices.size(), 10); //Take at most 10 bounding boxes (sorted by overlap)
 	for(int i = 0; i < numIterations; i++) {
 		int idx = positiveIndices.at(i).first;
@@ -224,112 +401,397 @@ void TLD::initialLearning() {
 		detectorCascade->ensembleClassifier->learn(true, &detectionResult->featureVectors[detectorCascade->numTrees*idx]);
 	}
 
-	srand(1); //TODO: This is not guaranteed to affect random_shuffle
+	learnWarpedPositives(positiveIndices, numIterations);
 
-	random_shuffle(negativeIndices.begin(), negativeIndices.end());
+	//Local generator instead of rand(), so that several instances can be initialised concurrently
+	RNG rng(1);
+	random_shuffle(negativeIndices.begin(), negativeIndices.end(), [&](int n) { return rng.uniform(0, n); });
 
 	//Choose 100 random patches for negative examples
-	for(size_t i = 0; i < min<size_t>(100,negativeIndices.size()); i++) {
-		int idx = negativeIndices.at(i);
+	negativeIndices.resize(min<size_t>(100,negativeIndices.size()));
+
+	nnClassifier->learn(currImg, *currBB.get(), negativeIndices);
+}
+
+void TLD::setLearningBudget(float confidence, int maxPositives, int maxNegatives, int maxNegativesNN) {
+	learningConfidence = confidence;
+	this->maxPositives = maxPositives;
+	this->maxNegatives = maxNegatives;
+	this->maxNegativesNN = maxNegativesNN;
+}
+
+void TLD::setDetectionSchedule(int maxInterval, float minConfidence, float maxFbError, float maxMotion) {
+	maxDetectionInterval = maxInterval;
+	detectionConfidence = minConfidence;
+	maxDetectionFbError = maxFbError;
+	maxDetectionMotion = maxMotion;
+}
+
+//Adapts the number of frames from one full scan of the detector to the next. The interval grows by one frame
+//while the tracker is reliable and drops back to 1 as soon as it is not, so a drifting tracker is checked in the next frame.
+void TLD::updateDetectionSchedule() {
+	if(detectionMode == DETECTION_FULL) {
+		framesSinceFullScan = 0;
+	} else {
+		framesSinceFullScan++;
+	}
+
+	auto const & trackerBB = medianFlowTracker->trackerBB;
+
+	//The result must come from the tracker
+	bool reliable = valid && trackerBB && prevBB && currConf >= detectionConfidence && medianFlowTracker->fbError <= maxDetectionFbError
+			&& tldOverlapRectRect(*trackerBB, *currBB) >= 0.5;
+
+	if(reliable) {
+		//Displacement of the center, relative to the size of the box
+		float const dx = (trackerBB->x + 0.5f * trackerBB->width) - (prevBB->x + 0.5f * prevBB->width);
+		float const dy = (trackerBB->y + 0.5f * trackerBB->height) - (prevBB->y + 0.5f * prevBB->height);
+		reliable = sqrt(dx * dx + dy * dy) <= maxDetectionMotion * max(trackerBB->width, trackerBB->height);
+	}
+
+	detectionInterval = reliable ? min(detectionInterval + 1, maxDetectionInterval) : 1;
+}
+
+//Returns true if the frame shows something the model does not represent well yet
+bool TLD::learningIsWorthwhile() const {
+	//Low confidence
+	if(currConf <= learningConfidence) {
+		return true;
+	}
 
-		NormalizedPatch patch;
-		tldExtractNormalizedPatchBB(currImg, &detectorCascade->windows[TLD_WINDOW_SIZE*idx], patch.values);
-		patch.positive = 0;
-		patches.push_back(patch);
+	//The result comes from the detector alone, or the tracker has been overruled by it
+	auto const & trackerBB = medianFlowTracker->trackerBB;
+
+	if(!trackerBB || tldOverlapRectRect(*trackerBB.get(), *currBB.get()) < 0.5) {
+		return true;
 	}
 
-	detectorCascade->nnClassifier->learn(patches);
+	//The detector fires somewhere else
+	std::shared_ptr<DetectionResult> detectionResult = detectorCascade->detectionResult;
+	int box[4];
+	tldRectToArray<int>(*currBB.get(), box);
+
+	for(size_t i = 0; i < detectionResult->confidentIndices.size(); i++) {
+		int * window = &detectorCascade->windows[TLD_WINDOW_SIZE*detectionResult->confidentIndices[i]];
+
+		if(tldBBOverlap(window, box) < 0.2) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//Keeps the count windows with the highest posteriors
+static void selectHardestNegatives(vector<int> & indices, vector<float> const & posteriors, int count) {
+	if(count <= 0 || indices.size() <= (size_t) count) return;
 
-	delete[] overlap;
+	partial_sort(indices.begin(), indices.begin() + count, indices.end(), [&](int a, int b) {
+		return posteriors[a] > posteriors[b];
+	});
 
+	indices.resize(count);
+}
+
+//Learns the fern codes of the positive windows on randomly warped copies of the frame.
+//The warps are generated in parallel, only the region covered by the positive windows is warped.
+void TLD::learnWarpedPositives(vector<pair<int,float> > const & positiveIndices, int numPositives) {
+	if(numWarps <= 0 || numPositives <= 0 || !detectorCascade->ensembleClassifier->enabled) return;
+
+	shared_ptr<EnsembleClassifier> ec = detectorCascade->ensembleClassifier;
+	int const numTrees = detectorCascade->numTrees;
+
+	Rect roi;
+
+	for(int i = 0; i < numPositives; i++) {
+		int * bb = &detectorCascade->windows[TLD_WINDOW_SIZE*positiveIndices[i].first];
+		Rect window(bb[0], bb[1], bb[2], bb[3]);
+		roi = (i == 0) ? window : (roi | window);
+	}
+
+	Point2f const center(currBB->x + 0.5f*currBB->width, currBB->y + 0.5f*currBB->height);
+
+	vector<int> featureVectors(numWarps * numPositives * numTrees);
+
+	#pragma omp parallel
+	{
+		//Outside of roi, the fern codes read the original frame
+		Mat warped = currImg.clone();
+		Mat warpedRoi = warped(roi);
+
+		#pragma omp for
+		for(int w = 0; w < numWarps; w++) {
+			RNG rng(w + 1); //Independent of the thread that generates the warp
+
+			//Parameters as in the original TLD: +-10 degrees, +-2% scale, +-2% shift and some noise
+			double const angle = rng.uniform(-10.0, 10.0);
+			double const scale = 1 + rng.uniform(-0.02, 0.02);
+
+			Mat transform = getRotationMatrix2D(center, angle, scale);
+			transform.at<double>(0,2) += rng.uniform(-0.02, 0.02) * currBB->width - roi.x;
+			transform.at<double>(1,2) += rng.uniform(-0.02, 0.02) * currBB->height - roi.y;
+
+			warpAffine(currImg, warpedRoi, transform, roi.size(), INTER_LINEAR, BORDER_REPLICATE);
+
+			for(int y = 0; y < roi.height; y++) {
+				unsigned char * row = warpedRoi.ptr<unsigned char>(y);
+
+				for(int x = 0; x < roi.width; x++) {
+					row[x] = saturate_cast<unsigned char>(row[x] + rng.gaussian(5));
+				}
+			}
+
+			for(int i = 0; i < numPositives; i++) {
+				int * featureVector = &featureVectors[(w * numPositives + i) * numTrees];
+				ec->calcFeatureVector(warped.data, positiveIndices[i].first, featureVector);
+			}
+		}
+	}
+
+	//Learning depends on the order of the samples, so it is done sequentially
+	for(size_t i = 0; i < featureVectors.size(); i += numTrees) {
+		ec->learn(true, &featureVectors[i]);
+	}
 }
 
 //Do this when current trajectory is valid
 void TLD::learn() {
+	numLearnedSamples = 0;
+
 	if(!learningEnabled || !valid || !detectorEnabled) {
 		learning = false;
 		return;
 	}
-	learning = true;
 
     std::shared_ptr<DetectionResult> detectionResult = detectorCascade->detectionResult;
 
 	if(!detectionResult->containsValidData) {
 		detectorCascade->detect(currImg);
+		detectionMode = DETECTION_FULL;
 	}
 
-	//This is the positive patch
-	NormalizedPatch patch;
-    tldExtractNormalizedPatchRect(currImg, *currBB.get(), patch.values);
+	if(!learningIsWorthwhile()) {
+		learning = false;
+		return;
+	}
 
-	float * overlap = new float[detectorCascade->numWindows];
-    tldOverlapRect(detectorCascade->windows, detectorCascade->numWindows, *currBB.get(), overlap);
+	learning = true;
 
 	//Add all bounding boxes with high overlap
 
-	vector<pair<int,float> > positiveIndices;
-	vector<int> negativeIndices;
-	vector<int> negativeIndicesForNN;
+	vector<pair<int,float> > & positiveIndices = learnPositiveIndices;
+	vector<int> & negativeIndices = learnNegativeIndices;
+	vector<int> & negativeIndicesForNN = learnNegativeIndicesForNN;
+	positiveIndices.clear();
+	negativeIndices.clear();
+	negativeIndicesForNN.clear();
+	negativeIndices.reserve(detectorCascade->numWindows); //Almost all windows may be negatives
+	negativeIndicesForNN.reserve(detectorCascade->numWindows);
 
 	//First: Find overlapping positive and negative patches
+	detectorCascade->findOverlappingWindows(*currBB.get(), 0.6, positiveIndices);
 
-	for(int i = 0; i < detectorCascade->numWindows; i++) {
+	bool const ensembleEnabled = detectorCascade->ensembleClassifier->enabled;
+	detectorCascade->findNegativeWindows(*currBB.get(), 0.2, detectionResult->posteriors, ensembleEnabled ? 0.1 : -1, negativeIndices); //TODO: Shouldn't this read as 0.5?
 
-		if(overlap[i] > 0.6) {
-			positiveIndices.push_back(pair<int,float>(i,overlap[i]));
-		}
+	//After a local scan, the other windows have not been evaluated in this frame, their features and posteriors are stale
+	if(detectionResult->scanRegion) {
+		int region[4];
+		tldRectToArray<int>(*detectionResult->scanRegion, region);
 
-		if(overlap[i] < 0.2) {
-			if(!detectorCascade->ensembleClassifier->enabled || detectionResult->posteriors[i] > 0.1) { //TODO: Shouldn't this read as 0.5?
-				negativeIndices.push_back(i);
-			}
+		auto outsideRegion = [&](int i) {
+			return !tldIsInside(&detectorCascade->windows[TLD_WINDOW_SIZE*i], region);
+		};
 
-			if(!detectorCascade->ensembleClassifier->enabled || detectionResult->posteriors[i] > 0.5) {
-				negativeIndicesForNN.push_back(i);
-			}
+		positiveIndices.erase(remove_if(positiveIndices.begin(), positiveIndices.end(), [&](pair<int,float> const & p) {
+			return outsideRegion(p.first);
+		}), positiveIndices.end());
+		negativeIndices.erase(remove_if(negativeIndices.begin(), negativeIndices.end(), outsideRegion), negativeIndices.end());
+	}
 
+	for(size_t i = 0; i < negativeIndices.size(); i++) {
+		if(!ensembleEnabled || detectionResult->posteriors[negativeIndices[i]] > 0.5) {
+			negativeIndicesForNN.push_back(negativeIndices[i]);
 		}
 	}
 
-	sort(positiveIndices.begin(), positiveIndices.end(), tldSortByOverlapDesc);
+	//Only the best positives and the hardest negatives are learned
+	size_t const numPositives = (maxPositives > 0) ? min<size_t>(positiveIndices.size(), maxPositives) : positiveIndices.size();
+	partial_sort(positiveIndices.begin(), positiveIndices.begin() + numPositives, positiveIndices.end(), tldSortByOverlapDesc);
+
+	if(ensembleEnabled) {
+		selectHardestNegatives(negativeIndices, detectionResult->posteriors, maxNegatives);
+		selectHardestNegatives(negativeIndicesForNN, detectionResult->posteriors, maxNegativesNN);
+	} else {
+		//Without posteriors there is no ranking, so the budgets are a plain cap on the windows in scan order
+		if(maxNegatives > 0) negativeIndices.resize(min<size_t>(negativeIndices.size(), maxNegatives));
+		if(maxNegativesNN > 0) negativeIndicesForNN.resize(min<size_t>(negativeIndicesForNN.size(), maxNegativesNN));
+	}
 
-	vector<NormalizedPatch> patches;
+	numLearnedSamples = numPositives + negativeIndices.size() + negativeIndicesForNN.size() + 1;
 
-	patch.positive = 1;
-	patches.push_back(patch);
 	//TODO: Flip
 
+	//Copy everything that is needed, the detection result is overwritten in the next frame.
+	//Jobs for the learning thread also need their own copy of the frame, whose buffer is reused by processImage().
+	shared_ptr<LearningJob> job = asyncLearning ? freeLearningJob() : syncJob;
+
+	if(asyncLearning) {
+		currImg.copyTo(job->img);
+	} else {
+		job->img = currImg;
+	}
+
+	job->bb = *currBB.get();
+	job->negativeIndicesForNN.assign(negativeIndicesForNN.begin(), negativeIndicesForNN.end());
+	job->negativeFeatures.clear();
+	job->positiveFeatures.clear();
+
+	int const numTrees = detectorCascade->numTrees;
 
-	int numIterations = min<size_t>(positiveIndices.size(), 10); //Take at most 10 bounding boxes (sorted by overlap)
 	for(size_t i = 0; i < negativeIndices.size(); i++) {
-		int idx = negativeIndices.at(i);
-		//TODO: Somewhere here image warping might be possible
-		detectorCascade->ensembleClassifier->learn(false, &detectionResult->featureVectors[detectorCascade->numTrees*idx]);
+		int * featureVector = &detectionResult->featureVectors[numTrees*negativeIndices[i]];
+		job->negativeFeatures.insert(job->negativeFeatures.end(), featureVector, featureVector + numTrees);
+	}
+
+	for(size_t i = 0; i < numPositives; i++) {
+		int * featureVector = &detectionResult->featureVectors[numTrees*positiveIndices[i].first];
+		job->positiveFeatures.insert(job->positiveFeatures.end(), featureVector, featureVector + numTrees);
+	}
+
+	if(!asyncLearning) {
+		applyLearningJob(*job, false);
+		job->img.release();
+		return;
+	}
+
+	//Only the latest job is kept if the learning thread is still busy
+	lock_guard<mutex> lock(learningMutex);
+	pendingJob = job;
+	learningCondition.notify_all();
+}
+
+//Returns a job that is neither pending nor being learned. The learning thread drops its reference under the lock.
+shared_ptr<TLD::LearningJob> TLD::freeLearningJob() {
+	lock_guard<mutex> lock(learningMutex);
+
+	for(int i = 0; i < 3; i++) {
+		if(asyncJobs[i].use_count() == 1) return asyncJobs[i];
+	}
+
+	return make_shared<LearningJob>(); //Not reached, at most two jobs are in use
+}
+
+//backBuffer selects the copy of the model that is owned by the learning thread
+void TLD::applyLearningJob(LearningJob & job, bool backBuffer) {
+	shared_ptr<EnsembleClassifier> ec = detectorCascade->ensembleClassifier;
+	int const numTrees = detectorCascade->numTrees;
+
+	//TODO: Somewhere here image warping might be possible
+	for(size_t i = 0; i < job.negativeFeatures.size(); i += numTrees) {
+		int * featureVector = &job.negativeFeatures[i];
+		backBuffer ? ec->learnBackBuffer(false, featureVector) : ec->learn(false, featureVector);
 	}
 
 	//TODO: Randomization might be a good idea
-	for(int i = 0; i < numIterations; i++) {
-		int idx = positiveIndices.at(i).first;
-		//TODO: Somewhere here image warping might be possible
-		detectorCascade->ensembleClassifier->learn(true, &detectionResult->featureVectors[detectorCascade->numTrees*idx]);
+	for(size_t i = 0; i < job.positiveFeatures.size(); i += numTrees) {
+		int * featureVector = &job.positiveFeatures[i];
+		backBuffer ? ec->learnBackBuffer(true, featureVector) : ec->learn(true, featureVector);
 	}
 
-	for(size_t i = 0; i < negativeIndicesForNN.size(); i++) {
-		int idx = negativeIndicesForNN.at(i);
+	//The current bounding box is the positive patch
+	shared_ptr<NNClassifier> nn = backBuffer ? learnedNN : nnClassifier;
+	nn->learn(job.img, job.bb, job.negativeIndicesForNN);
+
+	//cout << "NN has now " << nn->numPositives() << " positives and " << nn->numNegatives() << " negatives.\n";
+}
+
+void TLD::setAsyncLearning(bool status) {
+	if(status == asyncLearning) return;
 
-		NormalizedPatch patch;
-		tldExtractNormalizedPatchBB(currImg, &detectorCascade->windows[TLD_WINDOW_SIZE*idx], patch.values);
-		patch.positive = 0;
-		patches.push_back(patch);
+	if(status) {
+		stopLearning = false;
+		asyncLearning = true;
+		learningThread = std::thread(&TLD::learningLoop, this);
+		return;
 	}
 
-	detectorCascade->nnClassifier->learn(patches);
+	waitForLearning();
 
-	//cout << "NN has now " << detectorCascade->nnClassifier->truePositives->size() << " positives and " << detectorCascade->nnClassifier->falsePositives->size() << " negatives.\n";
+	{
+		lock_guard<mutex> lock(learningMutex);
+		stopLearning = true;
+		learningCondition.notify_all();
+	}
 
-	delete[] overlap;
+	learningThread.join();
+	asyncLearning = false;
 }
 
+//Runs on the learning thread. While a job is processed, the detector keeps using the previous model.
+void TLD::learningLoop() {
+	unique_lock<mutex> lock(learningMutex);
+
+	while(true) {
+		learningCondition.wait(lock, [this] { return stopLearning || (pendingJob && !modelReady); });
+
+		if(stopLearning) return;
+
+		shared_ptr<LearningJob> job = pendingJob;
+		pendingJob.reset();
+		learningBusy = true;
+		shared_ptr<NNClassifier> nn = nnClassifier; //publishLearnedModel() replaces it under the lock
+		lock.unlock();
+
+		//The model used by the detector is not modified until publishLearnedModel() is called, so it can be copied here.
+		//The copy reuses the memory of the model that was replaced by the last swap.
+		detectorCascade->ensembleClassifier->prepareBackBuffer();
+
+		if(!learnedNN || !learnedNN->copyFrom(*nn)) {
+			learnedNN.reset(nn->clone());
+		}
+
+		applyLearningJob(*job, true);
+
+		lock.lock();
+		learningBusy = false;
+		modelReady = true;
+		learningCondition.notify_all();
+	}
+}
+
+//Swaps in the model of the learning thread, if a new one is available
+void TLD::publishLearnedModel() {
+	if(!asyncLearning) return;
+
+	lock_guard<mutex> lock(learningMutex);
+
+	if(!modelReady) return;
+
+	detectorCascade->ensembleClassifier->swapBackBuffer();
+	detectorCascade->nnClassifier = learnedNN;
+	learnedNN.swap(nnClassifier); //The previous model becomes the copy of the next job
+
+	modelReady = false;
+	learningCondition.notify_all();
+}
+
+//Drops pending jobs, waits for the running one and publishes its result
+void TLD::waitForLearning() {
+	if(!asyncLearning) return;
+
+	{
+		unique_lock<mutex> lock(learningMutex);
+		pendingJob.reset();
+		learningCondition.wait(lock, [this] { return !learningBusy; });
+	}
+
+	publishLearnedModel();
+}
+
+//Version 2 added the quantization of the NN samples, version 3 the patch size
+static const int TLD_MODEL_VERSION = 3;
+
 typedef struct {
 	int index;
 	int P;
@@ -337,41 +799,20 @@ typedef struct {
 } TldExportEntry;
 
 void TLD::writeToFile(const char * path) {
+	waitForLearning();
+
     std::shared_ptr<NNClassifier> nn = detectorCascade->nnClassifier;
     std::shared_ptr<EnsembleClassifier> ec = detectorCascade->ensembleClassifier;
 
 	FILE * file = fopen(path, "w");
-	fprintf(file,"#Tld ModelExport\n");
+	fprintf(file,"#Tld ModelExport %d\n", TLD_MODEL_VERSION);
 	fprintf(file,"%d #width\n", detectorCascade->objWidth);
 	fprintf(file,"%d #height\n", detectorCascade->objHeight);
 	fprintf(file,"%f #min_var\n", detectorCascade->varianceFilter->minVar);
-    fprintf(file,"%d #Positive Sample Size\n", nn->truePositives.size());
-
+	fprintf(file,"%d #quantization\n", nn->quantization);
+	fprintf(file,"%d #patchSize\n", nn->patchSize());
 
-    for(size_t s = 0; s < nn->truePositives.size();s++) {
-        float * imageData =nn->truePositives[s].values;
-		for(int i = 0; i < TLD_PATCH_SIZE; i++) {
-			for(int j = 0; j < TLD_PATCH_SIZE; j++) {
-				fprintf(file, "%f ", imageData[i*TLD_PATCH_SIZE+j]);
-			}
-			fprintf(file, "\n");
-		}
-	}
-
-    fprintf(file,"%d #Negative Sample Size\n", nn->falsePositives.size());
-
-    for(size_t s = 0; s < nn->falsePositives.size();s++)
-    {
-        float * imageData = nn->falsePositives[s].values;
-        for(int i = 0; i < TLD_PATCH_SIZE; i++)
-        {
-            for(int j = 0; j < TLD_PATCH_SIZE; j++)
-            {
-				fprintf(file, "%f ", imageData[i*TLD_PATCH_SIZE+j]);
-			}
-			fprintf(file, "\n");
-		}
-	}
+	nn->writeToFile(file);
 
     fprintf(file,"%d #numtrees\n", ec->dtc.numTrees);
     detectorCascade->numTrees = ec->dtc.numTrees;
@@ -413,6 +854,10 @@ void TLD::writeToFile(const char * path) {
 void TLD::readFromFile(const char * path) {
 	release();
 
+	//A loaded model has no selection time
+	selectionTick = 0;
+	selectionToFirstTrack = -1;
+
     std::shared_ptr<NNClassifier> nn = detectorCascade->nnClassifier;
     std::shared_ptr<EnsembleClassifier> ec = detectorCascade->ensembleClassifier;
 
@@ -425,7 +870,10 @@ void TLD::readFromFile(const char * path) {
 
 	int MAX_LEN=255;
 	char str_buf[255];
-	fgets(str_buf, MAX_LEN, file); /*Skip line*/
+	fgets(str_buf, MAX_LEN, file);
+
+	int version = 1; //Files without version number
+	sscanf(str_buf, "#Tld ModelExport %d", &version);
 
 	fscanf(file,"%d \n", &detectorCascade->objWidth);
 	fgets(str_buf, MAX_LEN, file); /*Skip rest of line*/
@@ -435,63 +883,33 @@ void TLD::readFromFile(const char * path) {
 	fscanf(file,"%f \n", &detectorCascade->varianceFilter->minVar);
 	fgets(str_buf, MAX_LEN, file); /*Skip rest of line*/
 
-	int numPositivePatches;
-	fscanf(file, "%d \n", &numPositivePatches);
-	fgets(str_buf, MAX_LEN, file); /*Skip line*/
-
-
-	for(int s = 0; s < numPositivePatches; s++) {
-		NormalizedPatch patch;
-
-		for(int i = 0; i < 15; i++) { //Do 15 times
-
-			fgets(str_buf, MAX_LEN, file); /*Read sample*/
-
-			char * pch;
-			pch = strtok (str_buf," ");
-			int j = 0;
-			while (pch != NULL)
-			{
-				float val = atof(pch);
-				patch.values[i*TLD_PATCH_SIZE+j] = val;
-
-				pch = strtok (NULL, " ");
-
-				j++;
-			}
-		}
+	int quantization = 0;
 
-        nn->truePositives.push_back(patch);
+	if(version >= 2) {
+		fscanf(file,"%d \n", &quantization);
+		fgets(str_buf, MAX_LEN, file); /*Skip rest of line*/
 	}
 
-	int numNegativePatches;
-	fscanf(file, "%d \n", &numNegativePatches);
-	fgets(str_buf, MAX_LEN, file); /*Skip line*/
-
-
-	for(int s = 0; s < numNegativePatches; s++) {
-		NormalizedPatch patch;
-		for(int i = 0; i < 15; i++) { //Do 15 times
-
-			fgets(str_buf, MAX_LEN, file); /*Read sample*/
-
-			char * pch;
-			pch = strtok (str_buf," ");
-			int j = 0;
-			while (pch != NULL)
-			{
-				float val = atof(pch);
-				patch.values[i*TLD_PATCH_SIZE+j] = val;
+	if(!nn->setQuantization(quantization)) {
+		printf("Error: Unsupported NN quantization %d in model %s\n", quantization, path);
+		exit(1);
+	}
 
-				pch = strtok (NULL, " ");
+	int patchSize = TLD_PATCH_SIZE;
 
-				j++;
-			}
-		}
+	if(version >= 3) {
+		fscanf(file,"%d \n", &patchSize);
+		fgets(str_buf, MAX_LEN, file); /*Skip rest of line*/
+	}
 
-        nn->falsePositives.push_back(patch);
+	if(!setPatchSize(patchSize)) {
+		printf("Error: Unsupported patch size %d in model %s\n", patchSize, path);
+		exit(1);
 	}
 
+	nn = nnClassifier;
+	nn->readFromFile(file);
+
     fscanf(file,"%d \n", &ec->dtc.numTrees);
     detectorCascade->numTrees = ec->dtc.numTrees;
 	fgets(str_buf, MAX_LEN, file); /*Skip rest of line*/
@@ -500,8 +918,7 @@ void TLD::readFromFile(const char * path) {
     detectorCascade->numFeatures = ec->dtc.numFeatures;
 	fgets(str_buf, MAX_LEN, file); /*Skip rest of line*/
 
-    int size = 2 * 2 * ec->dtc.numFeatures * ec->dtc.numTrees;
-	ec->features = new float[size];
+	ec->allocateFeatures();
     ec->numIndices = pow(2.0f, ec->dtc.numFeatures);
 	ec->initPosteriors();
 
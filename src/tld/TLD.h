@@ -34,12 +34,29 @@
 #include "MedianFlowTracker.h"
 #include "DetectorCascade.h"
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 using namespace cv;
 using namespace std;
 
 namespace tld {
 
+    //Result of one frame, passed to the callbacks of TLD::setResultCallbacks()
+    struct TLDResult {
+        int frame; //Frames since the selection of the object, counting this one
+        OptionalRect bb;
+        float confidence; //-1 for provisional results, which have not been classified
+        bool valid;
+        bool provisional; //Tracker estimate, published before detection and fusion
+        double frameStart; //cvGetTickCount() in milliseconds when processImage() was called
+        double timestamp; //... and when the result was published
+    };
+
+    typedef std::function<void (TLDResult const &)> TLDResultCallback;
+
     class TLD {
 
         public:
@@ -53,39 +70,87 @@ namespace tld {
             void drawDetection(IplImage * img) const;
             Mat  drawPosterios();
 
+            //Scan of the detector in the last frame
+            enum DetectionMode {
+                DETECTION_NONE,
+                DETECTION_LOCAL, //Only around the tracker result
+                DETECTION_FULL
+            };
+
         public:
             // Get / Sets
             shared_ptr<DetectorCascade> const & detector() const { return detectorCascade; }
-            shared_ptr<Rect> const & boundingBox() const { return currBB; }
+            OptionalRect const & boundingBox() const { return currBB; }
 
             inline float confidence() const { return currConf; }
             inline bool isLearning() const { return learningEnabled; }
             inline bool isAlternating() const { return alternating; }
+            inline int learnedSamples() const { return numLearnedSamples; }
+            inline int framesSinceSelection() const { return numFramesSinceSelection; }
+            inline DetectionMode lastDetectionMode() const { return detectionMode; }
+            inline int currentDetectionInterval() const { return detectionInterval; } //Frames from one full scan to the next
+            inline float selectionLatency() const { return selectionToFirstTrack; } //Milliseconds from selectObject() until the first frame was processed, -1 if unknown
 
 
             void setTracker(bool status) { trackerEnabled = status; }
             void setLearning(bool status) { learningEnabled = status; }
             void setAlternating(bool status) { alternating = status; }
+            void setConcurrentTracking(bool status);
+            void setAsyncLearning(bool status);
+            void setSeed(int seed) { detectorCascade->ensembleClassifier->setSeed(seed); }
+            void setNumWarps(int num) { numWarps = num; }
+            void setTrackerPoints(int num) { medianFlowTracker->maxPoints = num; }
+            void setTrackerObjectSize(int size) { medianFlowTracker->objectSize = size; }
+            void setNativeLK(bool status) { medianFlowTracker->nativeLK = status; }
+            void setMotionModel(bool status) { medianFlowTracker->motionModel = status; }
+            void setDetectionSchedule(int maxInterval, float minConfidence, float maxFbError, float maxMotion);
+            void setResultCallbacks(TLDResultCallback const & onProvisional, TLDResultCallback const & onFinal);
+            void setLearningBudget(float confidence, int maxPositives, int maxNegatives, int maxNegativesNN);
+            bool setPatchSize(int patchSize);
 
         private:
+            //Samples collected by learn(). They are applied either right away or by the learning thread.
+            struct LearningJob {
+                Mat img;
+                Rect bb;
+                vector<int> positiveFeatures; //Feature vectors of the positive windows, numTrees entries each
+                vector<int> negativeFeatures;
+                vector<int> negativeIndicesForNN;
+            };
+
             void storeCurrentData();
+            void publishTrackerResult(double frameStart);
+            void startTracking(double frameStart);
+            void waitForTracking();
+            void trackerLoop();
+            void publishResult(double frameStart);
             void fuseHypotheses();
             void learn();
+            void updateDetectionSchedule();
+            bool learningIsWorthwhile() const;
             void initialLearning();
+            void learnWarpedPositives(vector<pair<int,float> > const & positiveIndices, int numPositives);
+            shared_ptr<LearningJob> freeLearningJob();
+            void applyLearningJob(LearningJob & job, bool backBuffer);
+            void learningLoop();
+            void publishLearnedModel();
+            void waitForLearning();
 
         private:
             bool trackerEnabled;
             bool detectorEnabled;
             bool learningEnabled;
             bool alternating;
+            bool concurrentTracking; //The tracker runs on the tracker thread while the detector scans the frame
 
             bool valid;
             bool wasValid;
             Mat prevImg;
             Mat currImg;
+            Mat greyFrames[3]; //Buffers of the converted frames, reused by processImage()
 
-            shared_ptr<Rect> prevBB;
-            shared_ptr<Rect> currBB;
+            OptionalRect prevBB;
+            OptionalRect currBB;
 
             shared_ptr<MedianFlowTracker> medianFlowTracker;
             shared_ptr<DetectorCascade> detectorCascade;
@@ -94,6 +159,59 @@ namespace tld {
             float currConf;
             bool learning;
 
+            double selectionTick;
+            float selectionToFirstTrack;
+            int numFramesSinceSelection;
+
+            int numWarps; //Number of warped copies of the positive windows learned by initialLearning()
+
+            //Detection scheduler, see updateDetectionSchedule()
+            int maxDetectionInterval; //Upper limit of the frames from one full scan to the next. 1 scans every frame.
+            float detectionConfidence; //The interval only grows if the confidence of the tracker is at least this
+            float maxDetectionFbError; //... its forward-backward error is at most this many pixels
+            float maxDetectionMotion; //... and the box moves by at most this fraction of its size per frame
+            int detectionInterval;
+            int framesSinceFullScan;
+            DetectionMode detectionMode;
+
+            //Learning scheduler, see learn()
+            float learningConfidence; //Above this confidence, frames are only learned if tracker and detector disagree
+            int maxPositives; //Number of samples per frame, the hardest ones are kept. 0 means no limit.
+            int maxNegatives; //Without the ensemble classifier the negatives are not ranked, the first ones in scan order are kept
+            int maxNegativesNN;
+            int numLearnedSamples; //Number of samples passed to the classifiers in the last frame
+
+            //Working buffers of learn(), kept so that their memory is reused in the next frame
+            vector<pair<int,float> > learnPositiveIndices;
+            vector<int> learnNegativeIndices;
+            vector<int> learnNegativeIndicesForNN;
+            shared_ptr<LearningJob> syncJob; //Job of synchronous learning
+            shared_ptr<LearningJob> asyncJobs[3]; //Jobs of asynchronous learning: one pending, one being learned and one being filled
+
+            //Called with the tracker estimate as soon as the tracker is done, possibly on the tracker thread,
+            //and with the final result at the end of processImage()
+            TLDResultCallback provisionalCallback;
+            TLDResultCallback finalCallback;
+
+            //Concurrent tracking: processImage() hands the frame to the tracker thread and waits for it before fusing
+            std::thread trackerThread;
+            std::mutex trackerMutex;
+            std::condition_variable trackerCondition;
+            double trackerFrameStart;
+            bool trackerBusy; //The tracker thread has a frame to track
+            bool stopTracker;
+
+            //Asynchronous learning: The learning thread updates a copy of the model, which is swapped in at the next frame
+            bool asyncLearning;
+            std::thread learningThread;
+            std::mutex learningMutex;
+            std::condition_variable learningCondition;
+            shared_ptr<LearningJob> pendingJob;
+            shared_ptr<NNClassifier> learnedNN; //Copy of the model updated by the learning thread, swapped with the published one
+            bool learningBusy;
+            bool modelReady;
+            bool stopLearning;
+
             IplImage * _img_posterios;
     };
 
@@ -41,63 +41,6 @@ void tldBoundingBoxToPoints(int * bb, CvPoint * p1, CvPoint * p2) {
 
 
 
-//Returns mean-normalized patch, image must be greyscale
-void tldNormalizeImg(Mat img, float * output) {
-	int size = TLD_PATCH_SIZE;
-
-	Mat result;
-	resize(img, result, cvSize(size,size)); //Default is bilinear
-
-	float mean = 0;
-
-	unsigned char * imgData = (unsigned char *)result.data;
-
-	for(int i = 0; i < size; i++) {
-		for(int j = 0; j < size; j++) {
-			mean += imgData[j*result.step+ i];
-		}
-	}
-
-	mean /= size*size;
-
-
-	for(int i = 0; i < size; i++) {
-		for(int j = 0; j < size; j++) {
-			output[j*size+i] = imgData[j*result.step + i] - mean;
-		}
-	}
-
-}
-
-CvRect tldBoundaryToRect(int * boundary) {
-	return Rect(boundary[0], boundary[1],boundary[2],boundary[3]);
-}
-
-Mat tldExtractSubImage(Mat img, CvRect rect) {
-	Mat subImg = img(rect).clone();
-	return subImg;
-}
-
-Mat tldExtractSubImage(Mat img, int * boundary) {
-	return tldExtractSubImage(img, tldBoundaryToRect(boundary));
-}
-
-void tldExtractNormalizedPatch(Mat img, int x, int y, int w, int h, float * output) {
-	Mat subImage = tldExtractSubImage(img, Rect(x,y,w,h));
-	tldNormalizeImg(subImage, output);
-}
-
-//TODO: Rename
-void tldExtractNormalizedPatchBB(Mat img, int * boundary, float * output) {
-	int x,y,w,h;
-	tldExtractDimsFromArray(boundary, &x,&y,&w,&h);
-	tldExtractNormalizedPatch(img, x,y,w,h,output);
-}
-
-void tldExtractNormalizedPatchRect(Mat img, Rect & rect, float * output) {
-    tldExtractNormalizedPatch(img, rect.x, rect.y, rect.width, rect.height, output);
-}
-
 float CalculateMean(float * value, int n) {
 
     float sum = 0;
@@ -27,8 +27,11 @@
 #define TLDUTIL_H_
 
 #include <utility>
+#include <algorithm>
 #include <opencv/cv.h>
 
+#include "NormalizedPatch.h"
+
 using namespace cv;
 using namespace std;
 
@@ -87,13 +90,115 @@ int tldIsInside(int * bb1, int * bb2);
 void tldRectToPoints(CvRect rect, CvPoint * p1, CvPoint * p2);
 void tldBoundingBoxToPoints(int * bb, CvPoint * p1, CvPoint * p2);
 
-void tldNormalizeImg(IplImage * img, float * result, int size);
+//Returns mean-normalized patch, image must be greyscale
+//The rectangle is sampled bilinearly straight from img, using the same pixel mapping as
+//cv::resize with INTER_LINEAR. Nothing is allocated, as this is called from the parallel detection loop.
+//Samples of a rectangle reaching outside img are clamped to the image, replicating its border pixels.
+template <int N>
+void tldExtractNormalizedPatch(Mat const & img, int x, int y, int w, int h, float * output) {
+	int const size = N;
+
+	//Horizontal sampling positions are the same for every row
+	int col0[N];
+	int col1[N];
+	float alpha[N];
+
+	float const scaleX = (float) w / size;
+	float const scaleY = (float) h / size;
+
+	for(int j = 0; j < size; j++) {
+		float sx = (j + 0.5f) * scaleX - 0.5f;
+		int ix = cvFloor(sx);
+		float fx = sx - ix;
+
+		if(ix < 0) { ix = 0; fx = 0; }
+		if(ix >= w - 1) { ix = w - 1; fx = 0; }
+
+		col0[j] = max(0, min(x + ix, img.cols - 1));
+		col1[j] = max(0, min(x + min(ix + 1, w - 1), img.cols - 1));
+		alpha[j] = fx;
+	}
+
+	float top0[N], top1[N];
+	float bottom0[N], bottom1[N];
+
+	float mean = 0;
+
+	for(int i = 0; i < size; i++) {
+		float sy = (i + 0.5f) * scaleY - 0.5f;
+		int iy = cvFloor(sy);
+		float fy = sy - iy;
+
+		if(iy < 0) { iy = 0; fy = 0; }
+		if(iy >= h - 1) { iy = h - 1; fy = 0; }
+
+		unsigned char const * row0 = img.ptr<unsigned char>(max(0, min(y + iy, img.rows - 1)));
+		unsigned char const * row1 = img.ptr<unsigned char>(max(0, min(y + min(iy + 1, h - 1), img.rows - 1)));
+
+		//Gather the four neighbours first, so that the interpolation below is a plain vectorizable loop
+		for(int j = 0; j < size; j++) {
+			top0[j] = row0[col0[j]];
+			top1[j] = row0[col1[j]];
+			bottom0[j] = row1[col0[j]];
+			bottom1[j] = row1[col1[j]];
+		}
+
+		float * out = output + i*size;
+
+		for(int j = 0; j < size; j++) {
+			float const top = top0[j] + (top1[j] - top0[j]) * alpha[j];
+			float const bottom = bottom0[j] + (bottom1[j] - bottom0[j]) * alpha[j];
+			out[j] = top + (bottom - top) * fy;
+		}
+
+		for(int j = 0; j < size; j++) {
+			mean += out[j];
+		}
+	}
+
+	mean /= size*size;
+
+	for(int i = 0; i < size*size; i++) {
+		output[i] -= mean;
+	}
+}
+
+//TODO: Rename
+template <int N>
+void tldExtractNormalizedPatchBB(Mat const & img, int * boundary, float * output) {
+	int x,y,w,h;
+	tldExtractDimsFromArray(boundary, &x,&y,&w,&h);
+	tldExtractNormalizedPatch<N>(img, x,y,w,h,output);
+}
+
+template <int N>
+void tldExtractNormalizedPatchRect(Mat const & img, Rect const & rect, float * output) {
+    tldExtractNormalizedPatch<N>(img, rect.x, rect.y, rect.width, rect.height, output);
+}
+
+//Averages the patch over blocks of N/TLD_COARSE_PATCH_SIZE pixels.
+//The result is still mean-normalized, as every pixel contributes with the same weight.
+template <int N>
+void tldDownsamplePatch(float const * values, float * coarse) {
+	int const size = N;
+	int const coarseSize = TLD_COARSE_PATCH_SIZE;
+	int const block = size / coarseSize;
+
+	for(int i = 0; i < coarseSize; i++) {
+		for(int j = 0; j < coarseSize; j++) {
+			float sum = 0;
+
+			for(int y = i*block; y < (i+1)*block; y++) {
+				for(int x = j*block; x < (j+1)*block; x++) {
+					sum += values[y*size + x];
+				}
+			}
+
+			coarse[i*coarseSize + j] = sum / (block*block);
+		}
+	}
+}
 
-void tldExtractNormalizedPatch(Mat img, int x, int y, int w, int h, float * output);
-void tldExtractNormalizedPatchBB(Mat img, int * boundary, float * output);
-void tldExtractNormalizedPatchRect(Mat img, Rect &rect, float * output);
-IplImage * tldExtractSubImage(IplImage * img, int * boundary);
-IplImage * tldExtractSubImage(IplImage * img, int x, int y, int w, int h);
 
 float tldCalcMean(float * value, int n);
 float tldCalcVariance(float * value, int n);
@@ -102,6 +207,7 @@ bool tldSortByOverlapDesc(pair<int,float> bb1 , pair<int,float> bb2);
 Rect* tldCopyRect(Rect &r);
 
 //TODO: Change function names
+float tldBBOverlap(int * bb1, int * bb2);
 float tldOverlapRectRect(Rect const & r1, Rect const & r2);
 void tldOverlapOne(int * windows, int numWindows, int index, vector<int> &indices, vector<float> &overlap);
 void tldOverlap(int * windows, int numWindows, int * boundary, float * overlap);
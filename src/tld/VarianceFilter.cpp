@@ -56,12 +56,14 @@ float VarianceFilter::calcVariance(int *off) {
 void VarianceFilter::nextIteration(Mat img) {
 	if(!enabled) return;
 
-	release();
+	//The integral images are only reallocated if the frame size changes
+	if(!integralImg || integralImg->width != img.cols || integralImg->height != img.rows) {
+		release();
+		integralImg.reset( new IntegralImage<int>(img.size()) );
+		integralImg_squared.reset( new IntegralImage<long long>(img.size()) );
+	}
 
-    integralImg.reset( new IntegralImage<int>(img.size()) );
 	integralImg->calcIntImg(img);
-
-    integralImg_squared.reset( new IntegralImage<long long>(img.size()) );
 	integralImg_squared->calcIntImg(img, true);
 }
 